@@ -0,0 +1,311 @@
+#ifndef BATCH_SIMULATION_H
+#define BATCH_SIMULATION_H
+
+#include <../include/numa_topology.h>
+#include <../include/parallel_simulation.h>
+#include <../include/scenes.h>
+#include <../include/simulation.h>
+#include <../include/worker_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// many small independent worlds stepped in one process, e.g. for parameter sweeps.
+// worlds are packed side by side into a few big grids ("sheets") with a one cell wall
+// between neighbours. the canvas border is a wall too and nothing in the rules reaches
+// further than the next cell, so a packed world runs exactly as it would on its own
+// canvas, while a sheet is swept in long rows the way one big canvas is instead of
+// paying a sweep's setup and a cold cache for every tiny world. the sheets are spread
+// over a worker pool, each one run start to finish by whichever worker takes it
+
+// packed sheets are at most this wide, wider worlds get a sheet of their own
+const unsigned int BATCH_SHEET_WIDTH = 1024;
+// sheets per worker the packing aims for, so a worker that finishes early takes another
+const unsigned int BATCH_SHEETS_PER_WORKER = 4;
+// sheets get at least this many cells even when that means fewer of them
+const size_t BATCH_MIN_SHEET_CELLS = 256 * 1024;
+
+// one world of a batch: canvas size, ticks to run and the input scripted for each tick
+struct BatchWorld {
+    unsigned int width;
+    unsigned int height;
+    unsigned int ticks;
+    void (*input)(Simulation &simulation, unsigned int tick);
+};
+
+inline BatchWorld batchWorld(const Scene &scene)
+{
+    BatchWorld world = { scene.width, scene.height, scene.ticks, scene.input };
+    return world;
+}
+
+// a world after its last tick
+struct BatchResult {
+    uint64_t materialHash;
+    unsigned int materialCounts[MATERIAL_COUNT];
+};
+
+// where a world sits in its sheet
+struct WorldPlacement {
+    // index into the batch
+    size_t world;
+    unsigned int left;
+    unsigned int bottom;
+    unsigned int width;
+    unsigned int height;
+};
+
+struct SheetPlan {
+    unsigned int width;
+    unsigned int height;
+    std::vector<WorldPlacement> worlds;
+};
+
+// shelf packing: tallest worlds first, left to right along a shelf, a new shelf above
+// the last one when a row is full and a new sheet when it's tall enough
+inline std::vector<SheetPlan> packWorlds(const std::vector<BatchWorld> &worlds, unsigned int workers)
+{
+    size_t cells = 0;
+    std::vector<size_t> order;
+    for (size_t w = 0; w < worlds.size(); w++) {
+        cells += (size_t)worlds[w].width * worlds[w].height;
+        order.push_back(w);
+    }
+    std::stable_sort(order.begin(), order.end(), [&worlds](size_t a, size_t b) {
+        return worlds[a].height > worlds[b].height;
+    });
+    size_t sheetCells = std::max(cells / std::max(1u, workers * BATCH_SHEETS_PER_WORKER), BATCH_MIN_SHEET_CELLS);
+    unsigned int sheetHeight = (unsigned int)std::max<size_t>(sheetCells / BATCH_SHEET_WIDTH, 1);
+
+    std::vector<SheetPlan> sheets;
+    unsigned int x = 0;
+    unsigned int shelf = 0;
+    unsigned int shelfHeight = 0;
+    for (size_t o = 0; o < order.size(); o++) {
+        const BatchWorld &world = worlds[order[o]];
+        if (!sheets.empty() && x > 0 && x + world.width > BATCH_SHEET_WIDTH) {
+            // next shelf, one wall row above the tallest world of this one
+            shelf += shelfHeight + 1;
+            x = 0;
+            shelfHeight = 0;
+        }
+        if (sheets.empty() || (x == 0 && shelf > 0 && shelf + world.height > sheetHeight)) {
+            sheets.push_back(SheetPlan());
+            sheets.back().width = 0;
+            sheets.back().height = 0;
+            x = 0;
+            shelf = 0;
+            shelfHeight = 0;
+        }
+
+        SheetPlan &sheet = sheets.back();
+        WorldPlacement placement = { order[o], x, shelf, world.width, world.height };
+        sheet.worlds.push_back(placement);
+        sheet.width = std::max(sheet.width, x + world.width);
+        sheet.height = std::max(sheet.height, shelf + world.height);
+        x += world.width + 1;
+        shelfHeight = std::max(shelfHeight, world.height);
+    }
+    return sheets;
+}
+
+class PackedSheet;
+
+// one packed world seen as a simulation of its own, so the same input scripts drive it.
+// the worlds of a sheet only advance together, update() here does nothing
+class PackedWorld : public Simulation
+{
+public:
+    PackedWorld(PackedSheet &sheet, const WorldPlacement &placement) : sheet(&sheet), placement(placement) {}
+
+    unsigned int width() const { return placement.width; }
+    unsigned int height() const { return placement.height; }
+    void draw(double xpos, double ypos, int particleType);
+    bool update() { return false; }
+    bool settled() const;
+    const Rgba8 *pixels() const;
+    int pixelRowLength() const;
+    int material(unsigned int x, unsigned int y) const;
+    uint64_t materialHash() const;
+    void countMaterials(unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned int *counts);
+
+    BatchResult result()
+    {
+        BatchResult result;
+        result.materialHash = materialHash();
+        std::fill(result.materialCounts, result.materialCounts + MATERIAL_COUNT, 0u);
+        countMaterials(0, 0, placement.width, placement.height, result.materialCounts);
+        return result;
+    }
+
+    const WorldPlacement &where() const { return placement; }
+
+private:
+    PackedSheet *sheet;
+    WorldPlacement placement;
+};
+
+// the grid holding a sheet of worlds, walls everywhere between them
+class PackedSheet : public GridSimulation<Grid<unsigned char> >
+{
+public:
+    explicit PackedSheet(const SheetPlan &plan)
+        : GridSimulation<Grid<unsigned char> >(plan.width, plan.height)
+    {
+        cells.material.fillInterior(WALL);
+        std::vector<bool> inWorld((size_t)plan.width * plan.height, false);
+        for (size_t w = 0; w < plan.worlds.size(); w++) {
+            const WorldPlacement &placement = plan.worlds[w];
+            for (unsigned int y = 0; y < placement.height; y++) {
+                for (unsigned int x = 0; x < placement.width; x++) {
+                    cells.material[cells.material.index(placement.left + x, placement.bottom + y)] = EMPTY;
+                    inWorld[(size_t)(placement.bottom + y) * plan.width + placement.left + x] = true;
+                }
+            }
+            generateCanvas(cells.material, placement.left, placement.bottom, placement.width, placement.height);
+            worlds.push_back(PackedWorld(*this, placement));
+        }
+        // the heat field spans the sheet, the walls between the worlds keep each world's
+        // heat to itself the way the border round a world of its own does
+        for (unsigned int y = 0; y < plan.height; y++) {
+            for (unsigned int x = 0; x < plan.width; x++) {
+                if (!inWorld[(size_t)y * plan.width + x]) {
+                    heat.insulate(x, y);
+                }
+            }
+        }
+        initializeMotion(cells, motion);
+        renderCanvas(cells, colors.data());
+    }
+
+    std::vector<PackedWorld> &packedWorlds() { return worlds; }
+
+    // GridSimulation::draw for one world's canvas
+    void drawWorld(const WorldPlacement &placement, double xpos, double ypos, int particleType)
+    {
+        BrushArea area = brushArea(placement.width, placement.height, xpos, ypos);
+        paintArea(cells, area, placement.left, placement.bottom, particleType, motion, step);
+        for (int y = area.bottom; y <= area.top; y++) {
+            unsigned int row = placement.bottom + y;
+            renderRowSpan(cells.material, cells.colorVariation, row, placement.left + area.left, placement.left + area.right,
+                          colors.data() + (size_t)row * cells.width());
+        }
+        finishStreaming();
+        refreshViews();
+        heat.noteDrawn(particleType);
+
+        quiescent = false;
+        drawnSinceUpdate = true;
+    }
+    // ------------------------------------------------------------------------
+    int materialAt(unsigned int x, unsigned int y) const
+    {
+        return cells.material[cells.material.index(x, y)];
+    }
+    // ------------------------------------------------------------------------
+    uint64_t hashWorld(const WorldPlacement &placement) const
+    {
+        return hashMaterials(cells.material, placement.left, placement.bottom, placement.width, placement.height);
+    }
+    // ------------------------------------------------------------------------
+    // countMaterials for a rectangle of one world's canvas, clipped to that world
+    void countWorldMaterials(const WorldPlacement &placement, unsigned int x, unsigned int y, unsigned int w,
+                             unsigned int h, unsigned int *counts)
+    {
+        x = std::min(x, placement.width);
+        y = std::min(y, placement.height);
+        countMaterials(placement.left + x, placement.bottom + y, std::min(w, placement.width - x),
+                       std::min(h, placement.height - y), counts);
+    }
+
+private:
+    std::vector<PackedWorld> worlds;
+};
+
+inline void PackedWorld::draw(double xpos, double ypos, int particleType)
+{
+    sheet->drawWorld(placement, xpos, ypos, particleType);
+}
+
+inline bool PackedWorld::settled() const
+{
+    return sheet->settled();
+}
+
+inline const Rgba8 *PackedWorld::pixels() const
+{
+    return sheet->pixels() + (size_t)placement.bottom * sheet->pixelRowLength() + placement.left;
+}
+
+inline int PackedWorld::pixelRowLength() const
+{
+    return sheet->pixelRowLength();
+}
+
+inline int PackedWorld::material(unsigned int x, unsigned int y) const
+{
+    return sheet->materialAt(placement.left + x, placement.bottom + y);
+}
+
+inline uint64_t PackedWorld::materialHash() const
+{
+    return sheet->hashWorld(placement);
+}
+
+inline void PackedWorld::countMaterials(unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned int *counts)
+{
+    sheet->countWorldMaterials(placement, x, y, w, h, counts);
+}
+
+// run every world of a sheet for its ticks, its result goes into results
+inline void runSheet(const SheetPlan &plan, const std::vector<BatchWorld> &worlds, std::vector<BatchResult> &results)
+{
+    PackedSheet sheet(plan);
+    std::vector<PackedWorld> &packed = sheet.packedWorlds();
+
+    unsigned int ticks = 0;
+    for (size_t w = 0; w < packed.size(); w++) {
+        ticks = std::max(ticks, worlds[packed[w].where().world].ticks);
+    }
+    for (unsigned int tick = 0; tick < ticks; tick++) {
+        for (size_t w = 0; w < packed.size(); w++) {
+            const BatchWorld &world = worlds[packed[w].where().world];
+            if (tick < world.ticks) {
+                world.input(packed[w], tick);
+            }
+        }
+        sheet.update();
+        // worlds with fewer ticks are done, whatever the sheet does after this
+        for (size_t w = 0; w < packed.size(); w++) {
+            if (tick + 1 == worlds[packed[w].where().world].ticks) {
+                results[packed[w].where().world] = packed[w].result();
+            }
+        }
+    }
+}
+
+// run a batch of worlds on a pool of workers, parallelWorkerCount() unless given, and
+// return the result of each world in the order they were given
+inline std::vector<BatchResult> runBatch(const std::vector<BatchWorld> &worlds, unsigned int workers = parallelWorkerCount())
+{
+    std::vector<int> cpus = cpusForWorkers(workers);
+    std::vector<SheetPlan> sheets = packWorlds(worlds, (unsigned int)cpus.size());
+    // biggest sheets first so a long one doesn't start last and hold everyone up
+    std::stable_sort(sheets.begin(), sheets.end(), [&worlds](const SheetPlan &a, const SheetPlan &b) {
+        return (size_t)a.width * a.height * worlds[a.worlds[0].world].ticks > (size_t)b.width * b.height * worlds[b.worlds[0].world].ticks;
+    });
+
+    std::vector<BatchResult> results(worlds.size());
+    std::atomic<size_t> nextSheet(0);
+    WorkerPool pool(cpus);
+    pool.run([&](unsigned int worker) {
+        // sheets are created by the worker running them, so their memory is local to it
+        for (size_t s = nextSheet++; s < sheets.size(); s = nextSheet++) {
+            runSheet(sheets[s], worlds, results);
+        }
+    });
+    return results;
+}
+#endif
@@ -0,0 +1,164 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <../include/batch_simulation.h>
+#include <../include/engines.h>
+#include <../include/grid_memory.h>
+#include <../include/scenes.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// times an engine on a world that's poured into for the whole run, so the update never
+// gets to skip a settled world
+
+struct BenchmarkResult {
+    unsigned int ticks;
+    double seconds;
+    // what the grids ended up allocated in
+    std::string memory;
+    // how busy the engine's workers were, if it has any
+    std::string threads;
+};
+
+inline BenchmarkResult benchmarkEngine(unsigned int width, unsigned int height, const std::string &engine, unsigned int ticks)
+{
+    // pouring stops after this many ticks of a scene, start over before that
+    const unsigned int POUR_CYCLE = 500;
+
+    BenchmarkResult result;
+    std::unique_ptr<Simulation> simulation = makeSimulation(width, height, engine);
+    result.memory = gridMemoryReport();
+    result.ticks = ticks;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int tick = 0; tick < ticks; tick++) {
+        pourInput(*simulation, tick % POUR_CYCLE);
+        simulation->update();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.threads = simulation->threadReport();
+    return result;
+}
+
+inline void printBenchmark(const char *label, const BenchmarkResult &result, unsigned int width, unsigned int height)
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%-16s %u ticks in %.2f s, %.1f ticks/s, %.1f Mcells/s", label, result.ticks,
+             result.seconds, result.ticks / result.seconds, (double)width * height * result.ticks / result.seconds / 1e6);
+    std::cout << line << std::endl;
+    std::cout << "                 " << result.memory << std::endl;
+    if (!result.threads.empty()) {
+        std::cout << result.threads << std::endl;
+    }
+}
+
+// run the benchmark with huge page backed grids and again with plain pages
+inline int runBenchmarks(unsigned int width, unsigned int height, const std::string &engine, unsigned int ticks)
+{
+    std::cout << "Benchmarking engine " << engine << " at " << width << "x" << height << std::endl;
+
+    gridHugePagesEnabled() = true;
+    BenchmarkResult huge = benchmarkEngine(width, height, engine, ticks);
+    printBenchmark("huge pages:", huge, width, height);
+
+    gridHugePagesEnabled() = false;
+    BenchmarkResult plain = benchmarkEngine(width, height, engine, ticks);
+    printBenchmark("plain pages:", plain, width, height);
+    gridHugePagesEnabled() = true;
+
+    char line[80];
+    snprintf(line, sizeof(line), "huge pages speedup: %.2fx", plain.seconds / huge.seconds);
+    std::cout << line << std::endl;
+    return 0;
+}
+
+// worlds of the mixed batch check, small enough to be packed into one sheet side by side
+const unsigned int MIXED_BATCH_WIDTH = 64;
+const unsigned int MIXED_BATCH_HEIGHT = 48;
+const unsigned int MIXED_BATCH_TICKS = 250;
+
+// worlds running different scripts packed together, each checked against its script run
+// alone. a batch of equal worlds can't tell whether one world's doings leak into the
+// next, these do different things at different times. returns the worlds that differ
+inline unsigned int checkMixedBatch()
+{
+    static void (*const SCRIPTS[])(Simulation &simulation, unsigned int tick) = {
+        pourInput, lateOilInput, sandPileInput, damInput, edgeInput, lateOilInput, edgeHeaterInput, edgeWaterInput
+    };
+    std::vector<BatchWorld> batch;
+    for (size_t s = 0; s < sizeof(SCRIPTS) / sizeof(SCRIPTS[0]); s++) {
+        BatchWorld world = { MIXED_BATCH_WIDTH, MIXED_BATCH_HEIGHT, MIXED_BATCH_TICKS, SCRIPTS[s] };
+        batch.push_back(world);
+    }
+    std::vector<BatchResult> results = runBatch(batch);
+
+    unsigned int mismatches = 0;
+    for (size_t w = 0; w < batch.size(); w++) {
+        GridSimulation<Grid<unsigned char> > simulation(batch[w].width, batch[w].height);
+        for (unsigned int tick = 0; tick < batch[w].ticks; tick++) {
+            batch[w].input(simulation, tick);
+            simulation.update();
+        }
+        if (results[w].materialHash != simulation.materialHash()) {
+            std::cout << "mixed batch: world " << w << " differs from the same script run alone" << std::endl;
+            mismatches++;
+        }
+    }
+    if (mismatches == 0) {
+        std::cout << "mixed batch: " << batch.size() << " worlds match their scripts run alone" << std::endl;
+    }
+    return mismatches;
+}
+
+// time a batch of equal worlds packed together against running them one after another
+// the way separate processes would, and check that both give the same worlds. then
+// checkMixedBatch()
+inline int runBatchBenchmark(unsigned int width, unsigned int height, unsigned int worlds, unsigned int ticks)
+{
+    std::cout << "Benchmarking " << worlds << " worlds of " << width << "x" << height << " for " << ticks
+              << " ticks on " << cpusForWorkers(parallelWorkerCount()).size() << " workers" << std::endl;
+    BatchWorld world = { width, height, ticks, pourInput };
+    std::vector<BatchWorld> batch(worlds, world);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results = runBatch(batch);
+    double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    uint64_t hash = 0;
+    for (unsigned int w = 0; w < worlds; w++) {
+        GridSimulation<Grid<unsigned char> > simulation(width, height);
+        for (unsigned int tick = 0; tick < ticks; tick++) {
+            pourInput(simulation, tick);
+            simulation.update();
+        }
+        hash = simulation.materialHash();
+    }
+    double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned int mismatches = 0;
+    for (unsigned int w = 0; w < worlds; w++) {
+        mismatches += results[w].materialHash != hash;
+    }
+
+    double cellTicks = (double)width * height * ticks * worlds;
+    char line[160];
+    snprintf(line, sizeof(line), "batched:         %.2f s, %.1f worlds/s, %.1f Mcells/s", batchSeconds,
+             worlds / batchSeconds, cellTicks / batchSeconds / 1e6);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof(line), "one at a time:   %.2f s, %.1f worlds/s, %.1f Mcells/s", singleSeconds,
+             worlds / singleSeconds, cellTicks / singleSeconds / 1e6);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof(line), "batch speedup: %.2fx", singleSeconds / batchSeconds);
+    std::cout << line << std::endl;
+    if (mismatches > 0) {
+        std::cout << mismatches << " batched worlds differ from the same world run alone" << std::endl;
+    }
+    unsigned int mixedMismatches = checkMixedBatch();
+    return mismatches > 0 || mixedMismatches > 0 ? 1 : 0;
+}
+#endif
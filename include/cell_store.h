@@ -0,0 +1,45 @@
+#ifndef CELL_STORE_H
+#define CELL_STORE_H
+
+#include <../include/grid.h>
+
+// per-cell simulation state split by how often it's touched. the material id is read
+// for every cell on every tick, so it gets byte grids of its own (double buffered for
+// the update) and a sweep streams one byte per cell. everything else lives in separate
+// cold grids that a kernel only reads or writes for materials that carry them (see
+// MaterialDefinition::attributes), so adding an attribute doesn't widen the hot sweep.
+// GridT is the material grid type, the cold grids share its shape and layout
+template <typename GridT>
+struct CellStore {
+    // with firstTouch the grids are filled column range by column range on the threads
+    // that are going to sweep them, see GridFirstTouch
+    CellStore(unsigned int width, unsigned int height, unsigned char border, const GridFirstTouch *firstTouch = NULL)
+        : material(width, height, border, gridFill(firstTouch)),
+          nextMaterial(width, height, border, gridFill(firstTouch)),
+          velocity(width, height, 0, gridFill(firstTouch)),
+          colorVariation(width, height, 0, gridFill(firstTouch))
+    {
+        if (firstTouch == NULL) {
+            return;
+        }
+        firstTouch->touchColumns(width + 2, [this, border](unsigned int first, unsigned int last) {
+            material.fillColumns(first, last, border, 0);
+            nextMaterial.fillColumns(first, last, border, 0);
+            velocity.fillColumns(first, last, 0, 0);
+            colorVariation.fillColumns(first, last, 0, 0);
+        });
+    }
+
+    unsigned int width() const { return material.width(); }
+    unsigned int height() const { return material.height(); }
+
+    // hot: material of each cell this tick, and the one being written for the next tick
+    GridT material;
+    GridT nextMaterial;
+
+    // cold: rows per tick the particle is falling at
+    typename GridT::template Rebind<unsigned char> velocity;
+    // cold: shade offset from the material color, only the renderer reads it
+    typename GridT::template Rebind<signed char> colorVariation;
+};
+#endif
@@ -0,0 +1,95 @@
+#ifndef COLOR_OUTPUT_H
+#define COLOR_OUTPUT_H
+
+#include <../include/materials.h>
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SANDY_STREAMING_STORES 1
+#endif
+
+// display colors handed to the GPU, one 32-bit word per cell holding the bytes r, g, b, a
+// in memory order, which is what glTexImage2D reads for GL_RGBA/GL_UNSIGNED_BYTE
+typedef uint32_t Rgba8;
+
+inline Rgba8 packRgba8(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+    unsigned char bytes[4] = { r, g, b, a };
+    Rgba8 color;
+    std::memcpy(&color, bytes, sizeof(color));
+    return color;
+}
+
+inline unsigned char shadeByte(unsigned char channel, int variation)
+{
+    int shaded = channel + variation;
+    return (unsigned char)(shaded < 0 ? 0 : (shaded > 255 ? 255 : shaded));
+}
+
+// every color a cell can show, indexed by material and shade offset, so writing a cell's
+// color is a single table load
+class ColorTable
+{
+public:
+    static const int SHADES = 2 * COLOR_VARIATION_RANGE + 1;
+
+    ColorTable()
+    {
+        for (int type = 0; type < MATERIAL_COUNT; type++) {
+            const MaterialColor &color = materialDefinitions[type].color;
+            for (int shade = 0; shade < SHADES; shade++) {
+                int variation = shade - COLOR_VARIATION_RANGE;
+                colors[type][shade] = packRgba8(shadeByte(color.r, variation), shadeByte(color.g, variation),
+                                                shadeByte(color.b, variation), 255);
+            }
+        }
+    }
+
+    Rgba8 color(int particleType, int variation) const
+    {
+        return colors[particleType][variation + COLOR_VARIATION_RANGE];
+    }
+
+private:
+    Rgba8 colors[MATERIAL_COUNT][SHADES];
+};
+
+inline const ColorTable &colorTable()
+{
+    static const ColorTable table;
+    return table;
+}
+
+// flat colors of a run of cells given only their materials, e.g. a world that was sent
+// or stored without its color variation
+inline void colorMaterials(const unsigned char *materials, size_t count, Rgba8 *out)
+{
+    const ColorTable &table = colorTable();
+    for (size_t i = 0; i < count; i++) {
+        out[i] = table.color(materials[i] < MATERIAL_COUNT ? materials[i] : EMPTY, 0);
+    }
+}
+
+// write an output color without pulling its cache line in first. the output buffer is
+// only read again by the driver during the upload, so there's no point keeping it in
+// cache at the expense of the grid rows the sweep is still working on
+inline void streamColor(Rgba8 *out, Rgba8 color)
+{
+#ifdef SANDY_STREAMING_STORES
+    _mm_stream_si32((int *)out, (int)color);
+#else
+    *out = color;
+#endif
+}
+
+// make streamed colors visible before anything else reads the buffer
+inline void finishStreaming()
+{
+#ifdef SANDY_STREAMING_STORES
+    _mm_sfence();
+#endif
+}
+#endif
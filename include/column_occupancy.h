@@ -0,0 +1,96 @@
+#ifndef COLUMN_OCCUPANCY_H
+#define COLUMN_OCCUPANCY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// index of the highest set bit in a non-zero word
+inline unsigned int highestSetBit(uint64_t word)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return (unsigned int)index;
+#else
+    return 63 - (unsigned int)__builtin_clzll(word);
+#endif
+}
+
+// one bitset per column with a bit for every row that holds something a falling
+// particle can't pass through. row 0 is the bottom of the canvas, same as the texture.
+// lets a falling particle find its landing row with a couple of word scans instead
+// of walking down the column cell by cell
+class ColumnOccupancy
+{
+public:
+    ColumnOccupancy(unsigned int width, unsigned int height)
+        : width(width), height(height), wordsPerColumn((height + 63) / 64),
+          bits((size_t)width * ((height + 63) / 64), 0)
+    {
+    }
+
+    void set(unsigned int x, unsigned int y)
+    {
+        bits[wordIndex(x, y)] |= (uint64_t)1 << (y & 63);
+    }
+    // ------------------------------------------------------------------------
+    void clear(unsigned int x, unsigned int y)
+    {
+        bits[wordIndex(x, y)] &= ~((uint64_t)1 << (y & 63));
+    }
+    // ------------------------------------------------------------------------
+    bool test(unsigned int x, unsigned int y) const
+    {
+        return (bits[wordIndex(x, y)] >> (y & 63)) & 1;
+    }
+    // ------------------------------------------------------------------------
+    void reset()
+    {
+        std::fill(bits.begin(), bits.end(), 0);
+    }
+
+    // lowest row a particle at (x, y) reaches when it falls at most maxFall rows,
+    // stopping on top of the first occupied cell below it. returns y if the cell
+    // directly below is occupied
+    unsigned int landingRow(unsigned int x, unsigned int y, unsigned int maxFall) const
+    {
+        if (y == 0) {
+            return 0;
+        }
+        unsigned int lowest = y > maxFall ? y - maxFall : 0;
+        const uint64_t *column = &bits[(size_t)x * wordsPerColumn];
+
+        // scan from the row below the particle down to the lowest reachable row
+        int word = (int)((y - 1) >> 6);
+        int lowestWord = (int)(lowest >> 6);
+        uint64_t mask = ~(uint64_t)0 >> (63 - ((y - 1) & 63));
+        for (; word >= lowestWord; word--) {
+            uint64_t occupied = column[word] & mask;
+            if (word == lowestWord) {
+                occupied &= ~(uint64_t)0 << (lowest & 63);
+            }
+            if (occupied) {
+                return (unsigned int)(word << 6) + highestSetBit(occupied) + 1;
+            }
+            mask = ~(uint64_t)0;
+        }
+        return lowest;
+    }
+
+private:
+    unsigned int width;
+    unsigned int height;
+    unsigned int wordsPerColumn;
+    std::vector<uint64_t> bits;
+
+    size_t wordIndex(unsigned int x, unsigned int y) const
+    {
+        return (size_t)x * wordsPerColumn + (y >> 6);
+    }
+};
+#endif
@@ -0,0 +1,255 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <../include/materials.h>
+#include <../include/simulation.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+// input doesn't touch the world directly: whatever reads it (the window, a script, a
+// network client) posts commands, and the simulation applies them all at the start of
+// its next tick. the world is then only ever changed by the thread ticking it, wherever
+// that thread ends up
+
+// bounded multi-producer single-consumer queue without locks. every slot carries a
+// sequence number telling producers and the consumer whose turn it is, so a producer
+// claims a slot with one compare-and-swap on the tail and publishes it with one store.
+// push() never waits: when the queue is full the item is dropped and counted
+template <typename T>
+class BoundedMpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedMpscQueue(size_t capacity)
+        : head(0), tail(0), dropped(0)
+    {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        mask = rounded - 1;
+        slots.reset(new Slot[rounded]);
+        for (size_t s = 0; s < rounded; s++) {
+            slots[s].sequence.store(s, std::memory_order_relaxed);
+        }
+    }
+
+    // from any thread. false if the queue was full and the item was dropped
+    bool push(const T &value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+            if (lag == 0) {
+                // the slot is free for this position, claim it unless another producer
+                // got there first
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lag < 0) {
+                // the consumer hasn't emptied this slot since the last lap
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = value;
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    // from the consumer thread only. false if nothing has been published yet
+    bool pop(T &value)
+    {
+        Slot &slot = slots[head & mask];
+        if ((intptr_t)slot.sequence.load(std::memory_order_acquire) - (intptr_t)(head + 1) < 0) {
+            return false;
+        }
+        value = slot.value;
+        // free for the producer that comes around on the next lap
+        slot.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    // items push() had to drop so far
+    uint64_t droppedCount() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    // consumer side and producer side on cache lines of their own
+    alignas(64) size_t head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<uint64_t> dropped;
+};
+
+enum CommandType {
+    // paint the brush with a material
+    COMMAND_PAINT,
+    // clear the cells under the brush
+    COMMAND_ERASE,
+    // switch to another world, built elsewhere so the tick doesn't wait for it
+    COMMAND_LOAD,
+    // stop or resume ticking
+    COMMAND_PAUSE,
+    // advance a paused world by one tick
+    COMMAND_STEP,
+    // throw what's under the brush into the air
+    COMMAND_BLAST
+};
+
+struct Command {
+    CommandType type;
+    // paint, erase and blast: brush position in window coordinates, y down from the top
+    double xpos;
+    double ypos;
+    // paint: material to paint with
+    int particleType;
+    // pause: true to pause, false to resume
+    bool paused;
+    // load: the new world, owned by the command until it's applied
+    Simulation *world;
+};
+
+inline Command paintCommand(double xpos, double ypos, int particleType)
+{
+    Command command = { COMMAND_PAINT, xpos, ypos, particleType, false, NULL };
+    return command;
+}
+
+inline Command eraseCommand(double xpos, double ypos)
+{
+    Command command = { COMMAND_ERASE, xpos, ypos, EMPTY, false, NULL };
+    return command;
+}
+
+inline Command blastCommand(double xpos, double ypos)
+{
+    Command command = { COMMAND_BLAST, xpos, ypos, EMPTY, false, NULL };
+    return command;
+}
+
+inline Command pauseCommand(bool paused)
+{
+    Command command = { COMMAND_PAUSE, 0, 0, EMPTY, paused, NULL };
+    return command;
+}
+
+inline Command stepCommand()
+{
+    Command command = { COMMAND_STEP, 0, 0, EMPTY, false, NULL };
+    return command;
+}
+
+// the queue between input and the simulation. worlds of load commands that were never
+// applied are freed with it
+class CommandQueue : public BoundedMpscQueue<Command>
+{
+public:
+    explicit CommandQueue(size_t capacity) : BoundedMpscQueue<Command>(capacity) {}
+
+    ~CommandQueue()
+    {
+        Command command;
+        while (pop(command)) {
+            delete command.world;
+        }
+    }
+
+    // hand a world over to the simulation. false if the queue was full, the world is
+    // freed then
+    bool postLoad(std::unique_ptr<Simulation> world)
+    {
+        Command command = { COMMAND_LOAD, 0, 0, EMPTY, false, world.get() };
+        if (!push(command)) {
+            return false;
+        }
+        world.release();
+        return true;
+    }
+};
+
+// what the commands steer besides the world itself
+struct SimulationControl {
+    bool paused;
+    // ticks still to run while paused
+    unsigned int steps;
+
+    SimulationControl() : paused(false), steps(0) {}
+
+    // whether the next tick should run
+    bool shouldTick()
+    {
+        if (!paused) {
+            return true;
+        }
+        if (steps > 0) {
+            steps--;
+            return true;
+        }
+        return false;
+    }
+};
+
+// apply everything posted so far, in order. call at the start of a tick on the thread
+// that ticks. returns whether the world's pixels changed, a paused world doesn't get an
+// update() to report it
+inline bool applyCommands(CommandQueue &queue, std::unique_ptr<Simulation> &simulation, SimulationControl &control)
+{
+    bool pixelsChanged = false;
+    Command command;
+    while (queue.pop(command)) {
+        switch (command.type) {
+        case COMMAND_PAINT:
+            simulation->draw(command.xpos, command.ypos, command.particleType);
+            pixelsChanged = true;
+            break;
+        case COMMAND_ERASE:
+            simulation->draw(command.xpos, command.ypos, EMPTY);
+            pixelsChanged = true;
+            break;
+        case COMMAND_BLAST:
+            simulation->blast(command.xpos, command.ypos);
+            pixelsChanged = true;
+            break;
+        case COMMAND_LOAD: {
+            std::unique_ptr<Simulation> world(command.world);
+            // the window and anything else looking at the pixels is sized for this world
+            if (world->width() != simulation->width() || world->height() != simulation->height()) {
+                std::cout << "Not loading a " << world->width() << "x" << world->height() << " world into a "
+                          << simulation->width() << "x" << simulation->height() << " canvas" << std::endl;
+                break;
+            }
+            simulation.swap(world);
+            pixelsChanged = true;
+            break;
+        }
+        case COMMAND_PAUSE:
+            control.paused = command.paused;
+            control.steps = 0;
+            break;
+        case COMMAND_STEP:
+            control.steps++;
+            break;
+        }
+    }
+    return pixelsChanged;
+}
+#endif
@@ -0,0 +1,397 @@
+#ifndef DIFFERENTIAL_FUZZER_H
+#define DIFFERENTIAL_FUZZER_H
+
+#include <../include/batch_simulation.h>
+#include <../include/engines.h>
+
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// differential fuzzer: random small worlds and brush sequences are run on the reference
+// engine (or the engine's own oracle, see hasOwnRules) and an engine under test side by
+// side, comparing material hashes every tick. the reference has no heat and no free
+// particles, so the cases with heaters and blasts in them are run against the default
+// engine instead
+// a mismatch is shrunk to a minimal case (fewest ticks, strokes and cells that still
+// disagree) and printed so it can be replayed by hand. the engines' own material counts
+// are checked along the way against counting the cells one by one
+
+struct FuzzStroke {
+    unsigned int tick;
+    double xpos;
+    double ypos;
+    int particleType;
+    // throw what's under the brush into the air instead of painting
+    bool blast;
+};
+
+struct FuzzCase {
+    unsigned int width;
+    unsigned int height;
+    unsigned int ticks;
+    // heaters and blasts among the strokes, which only the grid engines have
+    bool gridOnly;
+    std::vector<FuzzStroke> strokes;
+};
+
+// where the two engines first disagreed, tick -1 if they never did
+struct FuzzMismatch {
+    int tick;
+    unsigned int x;
+    unsigned int y;
+    int expected;
+    int actual;
+};
+
+// what a case is checked against: the engine's oracle, or the default engine for grid
+// only cases when the oracle is the reference
+inline std::unique_ptr<Simulation> makeFuzzOracle(const FuzzCase &fuzzCase, const std::string &engine)
+{
+    if (fuzzCase.gridOnly && !hasOwnRules(engine)) {
+        return makeSimulation(fuzzCase.width, fuzzCase.height, "default");
+    }
+    return makeOracleSimulation(fuzzCase.width, fuzzCase.height, engine);
+}
+
+inline FuzzMismatch runFuzzCase(const FuzzCase &fuzzCase, const std::string &engine)
+{
+    std::unique_ptr<Simulation> reference = makeFuzzOracle(fuzzCase, engine);
+    std::unique_ptr<Simulation> tested = makeSimulation(fuzzCase.width, fuzzCase.height, engine);
+
+    FuzzMismatch mismatch = { -1, 0, 0, EMPTY, EMPTY };
+    size_t stroke = 0;
+    for (unsigned int tick = 0; tick < fuzzCase.ticks; tick++) {
+        for (; stroke < fuzzCase.strokes.size() && fuzzCase.strokes[stroke].tick == tick; stroke++) {
+            const FuzzStroke &s = fuzzCase.strokes[stroke];
+            if (s.blast) {
+                reference->blast(s.xpos, s.ypos);
+                tested->blast(s.xpos, s.ypos);
+            } else {
+                reference->draw(s.xpos, s.ypos, s.particleType);
+                tested->draw(s.xpos, s.ypos, s.particleType);
+            }
+        }
+        reference->update();
+        tested->update();
+
+        if (reference->materialHash() == tested->materialHash()) {
+            continue;
+        }
+        mismatch.tick = tick;
+        for (unsigned int y = 0; y < fuzzCase.height; y++) {
+            for (unsigned int x = 0; x < fuzzCase.width; x++) {
+                if (reference->material(x, y) != tested->material(x, y)) {
+                    mismatch.x = x;
+                    mismatch.y = y;
+                    mismatch.expected = reference->material(x, y);
+                    mismatch.actual = tested->material(x, y);
+                    return mismatch;
+                }
+            }
+        }
+        return mismatch;
+    }
+    return mismatch;
+}
+
+// blasts move material about without making or destroying any. with nothing in a case
+// that reacts or boils (its acid and heaters painted as sand instead), the cells of each
+// material in the world and in the air add up after every tick to what they did right
+// after the case last painted. returns the first tick they don't, -1 if they always do
+inline int runConservationCase(const FuzzCase &fuzzCase, const std::string &engine)
+{
+    std::unique_ptr<Simulation> simulation = makeSimulation(fuzzCase.width, fuzzCase.height, engine);
+    unsigned int expected[MATERIAL_COUNT] = {};
+    simulation->countMaterials(0, 0, fuzzCase.width, fuzzCase.height, expected);
+    size_t stroke = 0;
+    for (unsigned int tick = 0; tick < fuzzCase.ticks; tick++) {
+        bool painted = false;
+        for (; stroke < fuzzCase.strokes.size() && fuzzCase.strokes[stroke].tick == tick; stroke++) {
+            const FuzzStroke &s = fuzzCase.strokes[stroke];
+            if (s.blast) {
+                simulation->blast(s.xpos, s.ypos);
+                continue;
+            }
+            bool reacts = s.particleType == ACID || s.particleType == HEATER;
+            simulation->draw(s.xpos, s.ypos, reacts ? SAND : s.particleType);
+            painted = true;
+        }
+        if (painted) {
+            std::fill(expected, expected + MATERIAL_COUNT, 0);
+            simulation->countMaterials(0, 0, fuzzCase.width, fuzzCase.height, expected);
+            simulation->countMaterialsInAir(expected);
+        }
+        simulation->update();
+
+        unsigned int counts[MATERIAL_COUNT] = {};
+        simulation->countMaterials(0, 0, fuzzCase.width, fuzzCase.height, counts);
+        simulation->countMaterialsInAir(counts);
+        // all but empty, which a particle in the air leaves behind
+        if (!std::equal(counts + EMPTY + 1, counts + MATERIAL_COUNT, expected + EMPTY + 1)) {
+            return (int)tick;
+        }
+    }
+    return -1;
+}
+
+// a rectangle whose material counts came out different from counting its cells
+struct FuzzCountMismatch {
+    int tick;
+    unsigned int x;
+    unsigned int y;
+    unsigned int w;
+    unsigned int h;
+    int particleType;
+    unsigned int expected;
+    unsigned int actual;
+};
+
+// run a case's strokes on world and, after every tick of stepped, compare world's
+// countMaterials (and countMaterial and regionClear, which go through it) for random
+// rectangles against Simulation::countMaterials counting cell by cell. the rectangles
+// start anywhere up to a few cells past the world and run up to a few cells past its
+// far edges, so clipping and the tiles sticking out over the edge get counted too.
+// stepped is the world itself, or the sheet a packed world sits in
+inline FuzzCountMismatch runCountCase(const FuzzCase &fuzzCase, Simulation &world, Simulation &stepped, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    FuzzCountMismatch mismatch = { -1, 0, 0, 0, 0, EMPTY, 0, 0 };
+    size_t stroke = 0;
+    for (unsigned int tick = 0; tick < fuzzCase.ticks; tick++) {
+        for (; stroke < fuzzCase.strokes.size() && fuzzCase.strokes[stroke].tick == tick; stroke++) {
+            const FuzzStroke &s = fuzzCase.strokes[stroke];
+            if (s.blast) {
+                world.blast(s.xpos, s.ypos);
+            } else {
+                world.draw(s.xpos, s.ypos, s.particleType);
+            }
+        }
+        stepped.update();
+
+        for (int r = 0; r < 4; r++) {
+            // the whole world first, then random rectangles
+            unsigned int x = 0, y = 0, w = fuzzCase.width, h = fuzzCase.height;
+            if (r > 0) {
+                x = std::uniform_int_distribution<unsigned int>(0, fuzzCase.width + 2)(random);
+                y = std::uniform_int_distribution<unsigned int>(0, fuzzCase.height + 2)(random);
+                w = std::uniform_int_distribution<unsigned int>(0, fuzzCase.width + 4)(random);
+                h = std::uniform_int_distribution<unsigned int>(0, fuzzCase.height + 4)(random);
+            }
+            unsigned int expected[MATERIAL_COUNT] = {};
+            unsigned int actual[MATERIAL_COUNT] = {};
+            world.Simulation::countMaterials(x, y, w, h, expected);
+            world.countMaterials(x, y, w, h, actual);
+
+            FuzzCountMismatch found = { (int)tick, x, y, w, h, EMPTY, 0, 0 };
+            for (int m = 0; m < MATERIAL_COUNT; m++) {
+                if (expected[m] != actual[m]) {
+                    found.particleType = m;
+                    found.expected = expected[m];
+                    found.actual = actual[m];
+                    return found;
+                }
+            }
+            int particleType = (int)(random() % MATERIAL_COUNT);
+            unsigned int counted = world.countMaterial(particleType, x, y, w, h);
+            if (counted != expected[particleType]) {
+                found.particleType = particleType;
+                found.expected = expected[particleType];
+                found.actual = counted;
+                return found;
+            }
+            // regionClear as the number of cells that aren't empty
+            unsigned int full = std::accumulate(expected, expected + MATERIAL_COUNT, 0u) - expected[EMPTY];
+            unsigned int clear = world.regionClear(x, y, w, h) ? 0 : 1;
+            if (clear != std::min(full, 1u)) {
+                found.expected = full;
+                found.actual = clear;
+                return found;
+            }
+        }
+    }
+    return mismatch;
+}
+
+// runCountCase on a world running on an engine
+inline FuzzCountMismatch runCountCase(const FuzzCase &fuzzCase, const std::string &engine, uint32_t seed)
+{
+    std::unique_ptr<Simulation> simulation = makeSimulation(fuzzCase.width, fuzzCase.height, engine);
+    return runCountCase(fuzzCase, *simulation, *simulation, seed);
+}
+
+// runCountCase on a world packed into a sheet, off the sheet's corner so its cells don't
+// line up with the sheet's tiles, with another world next to it. packed worlds have no
+// blasts of their own, those strokes do nothing there
+inline FuzzCountMismatch runPackedCountCase(const FuzzCase &fuzzCase, uint32_t seed)
+{
+    SheetPlan plan;
+    WorldPlacement neighbour = { 0, 3, 5, 9, fuzzCase.height };
+    WorldPlacement placement = { 1, neighbour.left + neighbour.width + 1, 5, fuzzCase.width, fuzzCase.height };
+    plan.worlds.push_back(neighbour);
+    plan.worlds.push_back(placement);
+    plan.width = placement.left + placement.width + 2;
+    plan.height = placement.bottom + placement.height + 2;
+
+    PackedSheet sheet(plan);
+    // sand in the neighbour, for a count that wanders out of its world to pick up
+    sheet.packedWorlds()[0].draw(0.0, 0.0, SAND);
+    return runCountCase(fuzzCase, sheet.packedWorlds()[1], sheet, seed);
+}
+inline FuzzCase randomFuzzCase(std::mt19937 &random, bool gridOnly)
+{
+    FuzzCase fuzzCase;
+    fuzzCase.width = std::uniform_int_distribution<unsigned int>(2, 48)(random);
+    fuzzCase.height = std::uniform_int_distribution<unsigned int>(2, 48)(random);
+    fuzzCase.ticks = std::uniform_int_distribution<unsigned int>(1, 120)(random);
+    fuzzCase.gridOnly = gridOnly;
+
+    // mostly sand and water, some oil and acid to layer and react with them, walls to pile
+    // against and erasing to open holes. grid only cases add heaters to boil the water
+    // into steam and melt the sand into glass, and blasts to throw it all around
+    static const int STROKE_TYPES[12] = { SAND, SAND, SAND, WATER, WATER, WATER, OIL, ACID, WALL, EMPTY, HEATER, HEATER };
+    unsigned int strokeTypes = gridOnly ? 12 : 10;
+    unsigned int strokes = std::uniform_int_distribution<unsigned int>(0, 40)(random);
+    unsigned int tick = 0;
+    for (unsigned int s = 0; s < strokes && tick < fuzzCase.ticks; s++) {
+        FuzzStroke stroke;
+        stroke.tick = tick;
+        // allowed to hang off every edge so clipping gets exercised too
+        stroke.xpos = std::uniform_real_distribution<double>(-12.0, fuzzCase.width + 2.0)(random);
+        stroke.ypos = std::uniform_real_distribution<double>(-2.0, fuzzCase.height + 12.0)(random);
+        stroke.particleType = STROKE_TYPES[random() % strokeTypes];
+        stroke.blast = gridOnly && random() % 8 == 0;
+        fuzzCase.strokes.push_back(stroke);
+        tick += std::uniform_int_distribution<unsigned int>(0, 4)(random);
+    }
+    return fuzzCase;
+}
+
+// shrink a failing case while it keeps failing: stop at the failing tick, drop strokes
+// one at a time, then cut columns and rows off the canvas
+inline FuzzCase minimizeFuzzCase(FuzzCase fuzzCase, const std::string &engine)
+{
+    FuzzMismatch mismatch = runFuzzCase(fuzzCase, engine);
+    bool shrunk = true;
+    while (shrunk) {
+        shrunk = false;
+        fuzzCase.ticks = mismatch.tick + 1;
+        while (!fuzzCase.strokes.empty() && fuzzCase.strokes.back().tick >= fuzzCase.ticks) {
+            fuzzCase.strokes.pop_back();
+        }
+
+        for (size_t s = 0; s < fuzzCase.strokes.size(); s++) {
+            FuzzCase candidate = fuzzCase;
+            candidate.strokes.erase(candidate.strokes.begin() + s);
+            FuzzMismatch candidateMismatch = runFuzzCase(candidate, engine);
+            if (candidateMismatch.tick >= 0) {
+                fuzzCase = candidate;
+                mismatch = candidateMismatch;
+                shrunk = true;
+                s--;
+            }
+        }
+
+        for (int dimension = 0; dimension < 2; dimension++) {
+            FuzzCase candidate = fuzzCase;
+            unsigned int &size = dimension == 0 ? candidate.width : candidate.height;
+            if (size <= 2) {
+                continue;
+            }
+            size--;
+            FuzzMismatch candidateMismatch = runFuzzCase(candidate, engine);
+            if (candidateMismatch.tick >= 0) {
+                fuzzCase = candidate;
+                mismatch = candidateMismatch;
+                shrunk = true;
+            }
+        }
+    }
+    return fuzzCase;
+}
+
+inline void printFuzzStrokes(const FuzzCase &fuzzCase)
+{
+    std::cout << "  canvas " << fuzzCase.width << "x" << fuzzCase.height << ", " << fuzzCase.ticks << " ticks"
+              << (fuzzCase.gridOnly ? ", grid only" : "") << std::endl;
+    for (size_t s = 0; s < fuzzCase.strokes.size(); s++) {
+        const FuzzStroke &stroke = fuzzCase.strokes[s];
+        if (stroke.blast) {
+            std::cout << "  tick " << stroke.tick << ": blast(" << stroke.xpos << ", " << stroke.ypos << ")" << std::endl;
+            continue;
+        }
+        std::cout << "  tick " << stroke.tick << ": draw(" << stroke.xpos << ", " << stroke.ypos << ", "
+                  << materialDefinitions[stroke.particleType].name << ")" << std::endl;
+    }
+}
+
+inline void printFuzzCase(const FuzzCase &fuzzCase, const FuzzMismatch &mismatch)
+{
+    printFuzzStrokes(fuzzCase);
+    std::cout << "  tick " << mismatch.tick << ": cell (" << mismatch.x << ", " << mismatch.y << ") should be "
+              << materialDefinitions[mismatch.expected].name << ", " << "is " << materialDefinitions[mismatch.actual].name << std::endl;
+}
+
+inline void printFuzzCountMismatch(const FuzzCase &fuzzCase, const FuzzCountMismatch &mismatch)
+{
+    printFuzzStrokes(fuzzCase);
+    std::cout << "  tick " << mismatch.tick << ": " << mismatch.w << "x" << mismatch.h << " at (" << mismatch.x << ", "
+              << mismatch.y << ") has " << mismatch.expected << " " << materialDefinitions[mismatch.particleType].name
+              << ", counted " << mismatch.actual << std::endl;
+}
+
+// fuzz an engine against its oracle for some number of random cases. true if they
+// agreed on all of them, otherwise the first mismatch is minimized and printed. every
+// other case is grid only unless the engine is the reference or the default one, which
+// those cases would only check against themselves. on every engine with free particles
+// every other case also checks that blasts lose nothing, see runConservationCase. every
+// case checks the engine's material counts, see runCountCase, and fuzzing the dynamic
+// engine, the grid packed sheets run on, checks them on packed worlds too
+inline bool fuzzEngine(const std::string &engine, unsigned int cases, uint32_t seed)
+{
+    bool gridOnly = engine != "reference" && engine != "default";
+    std::cout << "Fuzzing engine " << engine << " against " << oracleName(engine)
+              << (gridOnly && !hasOwnRules(engine) ? " (the default engine for heat and blasts)" : "") << ", seed " << seed
+              << std::endl;
+    std::mt19937 random(seed);
+    for (unsigned int c = 0; c < cases; c++) {
+        FuzzCase fuzzCase = randomFuzzCase(random, gridOnly && c % 2 == 1);
+        if (runFuzzCase(fuzzCase, engine).tick >= 0) {
+            std::cout << "case " << c << " mismatched, minimizing..." << std::endl;
+            FuzzCase minimal = minimizeFuzzCase(fuzzCase, engine);
+            printFuzzCase(minimal, runFuzzCase(minimal, engine));
+            return false;
+        }
+
+        uint32_t countSeed = random();
+        FuzzCountMismatch miscounted = runCountCase(fuzzCase, engine, countSeed);
+        const char *where = "";
+        if (miscounted.tick < 0 && engine == "dynamic") {
+            miscounted = runPackedCountCase(fuzzCase, countSeed);
+            where = " in a packed world";
+        }
+        if (miscounted.tick >= 0) {
+            std::cout << "case " << c << " miscounted materials" << where << ":" << std::endl;
+            printFuzzCountMismatch(fuzzCase, miscounted);
+            return false;
+        }
+
+        if (engine == "reference" || c % 2 == 0) {
+            continue;
+        }
+        FuzzCase thrown = fuzzCase.gridOnly ? fuzzCase : randomFuzzCase(random, true);
+        int lost = runConservationCase(thrown, engine);
+        if (lost >= 0) {
+            std::cout << "case " << c << " doesn't add up to the materials it started with after tick " << lost
+                      << ", acid and heaters painted as sand:" << std::endl;
+            printFuzzStrokes(thrown);
+            return false;
+        }
+    }
+    std::cout << cases << " cases matched" << std::endl;
+    return true;
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef ENGINES_H
+#define ENGINES_H
+
+#include <../include/simulation.h>
+#include <../include/intent_simulation.h>
+#include <../include/parallel_simulation.h>
+#include <../include/reference_simulation.h>
+#include <../include/stealing_simulation.h>
+
+#include <memory>
+#include <string>
+
+// pick the simulation for a canvas size. sizes we deploy at get a grid with compile-time
+// dimensions so the row sweeps run with constant strides; anything else falls back to
+// the runtime sized grid running the same kernels, tiled when it's very wide. a build
+// for another deployment size can add its own specialisation with
+// -DSANDY_GRID_WIDTH=... -DSANDY_GRID_HEIGHT=...
+inline std::unique_ptr<Simulation> makeDefaultSimulation(unsigned int width, unsigned int height) {
+    if (width == 837 && height == 600) {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char, 837, 600, CanvasLayout> >(width, height));
+    }
+    if (width == 1920 && height == 1080) {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char, 1920, 1080, CanvasLayout> >(width, height));
+    }
+#if defined(SANDY_GRID_WIDTH) && defined(SANDY_GRID_HEIGHT)
+    if (width == SANDY_GRID_WIDTH && height == SANDY_GRID_HEIGHT) {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char, SANDY_GRID_WIDTH, SANDY_GRID_HEIGHT, CanvasLayout> >(width, height));
+    }
+#endif
+    if (width >= TILED_LAYOUT_MIN_WIDTH) {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char, DYNAMIC_EXTENT, DYNAMIC_EXTENT, TiledLayout> >(width, height));
+    }
+    return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char> >(width, height));
+}
+
+// engines that can be asked for by name, e.g. to check one against the golden hashes.
+// every engine has to produce exactly the same worlds as the reference one, except those
+// that resolve moves by rules of their own (see hasOwnRules)
+const char *const ENGINE_NAMES[] = {
+    // whatever makeDefaultSimulation picks for the size
+    "default",
+    // the slow, plain oracle the others are checked against
+    "reference",
+    // runtime sized row-major grid, whatever the size
+    "dynamic",
+    // runtime sized tiled grid, whatever the size
+    "tiled",
+    // the default grids swept by pinned worker threads, parallelWorkerCount() of them
+    "parallel",
+    // the same workers taking small tiles of the sweep from each other
+    "stealing",
+    // moves written as intents and resolved in a second pass, both passes spread over
+    // parallelWorkerCount() workers
+    "intent"
+};
+
+const int ENGINE_COUNT = sizeof(ENGINE_NAMES) / sizeof(ENGINE_NAMES[0]);
+
+inline bool isEngineName(const std::string &engine) {
+    for (int e = 0; e < ENGINE_COUNT; e++) {
+        if (engine == ENGINE_NAMES[e]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// simulation running on a named engine, null if there's no engine by that name
+inline std::unique_ptr<Simulation> makeSimulation(unsigned int width, unsigned int height, const std::string &engine = "default") {
+    if (engine == "default") {
+        return makeDefaultSimulation(width, height);
+    }
+    if (engine == "reference") {
+        return std::unique_ptr<Simulation>(new ReferenceSimulation(width, height));
+    }
+    if (engine == "dynamic") {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char> >(width, height));
+    }
+    if (engine == "tiled") {
+        return std::unique_ptr<Simulation>(new GridSimulation<Grid<unsigned char, DYNAMIC_EXTENT, DYNAMIC_EXTENT, TiledLayout> >(width, height));
+    }
+    if (engine == "parallel") {
+        return makeParallelSimulation(width, height);
+    }
+    if (engine == "stealing") {
+        return makeStealingSimulation(width, height);
+    }
+    if (engine == "intent") {
+        return makeIntentSimulation(width, height);
+    }
+    return std::unique_ptr<Simulation>();
+}
+
+// engines whose worlds differ from the reference's. they have to come out the same on
+// any number of workers instead, so their oracle is themselves on one thread
+inline bool hasOwnRules(const std::string &engine) {
+    return engine == "intent";
+}
+
+// what an engine's worlds are checked against, see hasOwnRules
+inline std::unique_ptr<Simulation> makeOracleSimulation(unsigned int width, unsigned int height, const std::string &engine) {
+    if (engine == "intent") {
+        return makeIntentSimulation(width, height, 1);
+    }
+    return makeSimulation(width, height, "reference");
+}
+
+inline std::string oracleName(const std::string &engine) {
+    return hasOwnRules(engine) ? engine + " on one worker" : std::string("the reference");
+}
+#endif
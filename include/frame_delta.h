@@ -0,0 +1,140 @@
+#ifndef FRAME_DELTA_H
+#define FRAME_DELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// material grids coded against the one before: the XOR of the two is zero wherever
+// nothing changed, and it's run-length coded as (zeros to skip, literal bytes) pairs
+// with the run lengths as LEB128 varints. a typical tick changes a small fraction of
+// the cells and codes to a few kB
+
+enum FrameKind {
+    // coded against an all empty grid (material 0), decodes on its own
+    FRAME_KEY,
+    // coded against the frame before it
+    FRAME_DELTA
+};
+
+inline void appendWord(std::string &out, uint32_t word)
+{
+    for (int b = 0; b < 4; b++) {
+        out += (char)(word >> (8 * b));
+    }
+}
+
+inline uint32_t readWord(const unsigned char *in)
+{
+    return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+inline void appendVarint(std::string &out, size_t value)
+{
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+// false if the varint runs past end
+inline bool readVarint(const unsigned char *&in, const unsigned char *end, size_t &value)
+{
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        unsigned char byte = *in++;
+        value |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the cell of the frame a delta is coded against, previous is NULL for a key frame
+inline unsigned char frameBase(const unsigned char *previous, size_t i)
+{
+    return previous != NULL ? previous[i] : 0;
+}
+
+// cells begin..end-1 of a frame, in the order of copyMaterials
+struct CellSpan {
+    size_t begin;
+    size_t end;
+};
+
+// append the XOR of previous and current, run-length coded, looking only at the cells
+// in spans (in order, not overlapping): everything outside them is taken to be
+// unchanged and only adds to the run of zeros before the next literals. previous may
+// be NULL for a key frame. the payload decodes like one from encodeFrameDelta
+inline void encodeFrameDeltaSpans(const unsigned char *previous, const unsigned char *current, size_t cells,
+                                  const CellSpan *spans, size_t spanCount, std::string &out)
+{
+    const uint64_t ZERO_WORD = 0;
+    // first cell of the run of zeros not yet appended
+    size_t zerosFrom = 0;
+    for (size_t s = 0; s < spanCount; s++) {
+        size_t i = spans[s].begin;
+        size_t end = spans[s].end;
+        while (i < end) {
+            // unchanged stretches are most of the grid, skip them a word at a time
+            while (i + sizeof(uint64_t) <= end &&
+                   memcmp(current + i, previous != NULL ? previous + i : (const unsigned char *)&ZERO_WORD,
+                          sizeof(uint64_t)) == 0) {
+                i += sizeof(uint64_t);
+            }
+            while (i < end && current[i] == frameBase(previous, i)) {
+                i++;
+            }
+            if (i == end) {
+                // the zeros go on into the next span
+                break;
+            }
+            size_t start = i;
+            // a lone unchanged cell costs less as a literal than as a pair of runs
+            while (i < end && (current[i] != frameBase(previous, i) ||
+                               (i + 1 < end && current[i + 1] != frameBase(previous, i + 1)))) {
+                i++;
+            }
+            appendVarint(out, start - zerosFrom);
+            appendVarint(out, i - start);
+            for (size_t c = start; c < i; c++) {
+                out += (char)(current[c] ^ frameBase(previous, c));
+            }
+            zerosFrom = i;
+        }
+    }
+    if (zerosFrom < cells) {
+        appendVarint(out, cells - zerosFrom);
+        appendVarint(out, 0);
+    }
+}
+
+// append the XOR of previous and current over the whole frame, see encodeFrameDeltaSpans
+inline void encodeFrameDelta(const unsigned char *previous, const unsigned char *current, size_t cells, std::string &out)
+{
+    CellSpan all = { 0, cells };
+    encodeFrameDeltaSpans(previous, current, cells, &all, 1, out);
+}
+
+// apply a payload from encodeFrameDelta to the previous frame. false if it's malformed
+inline bool decodeFrameDelta(const unsigned char *in, size_t length, unsigned char *frame, size_t cells)
+{
+    const unsigned char *end = in + length;
+    size_t i = 0;
+    while (in < end) {
+        size_t zeros, literals;
+        if (!readVarint(in, end, zeros) || !readVarint(in, end, literals) || zeros > cells - i ||
+            literals > cells - i - zeros || literals > (size_t)(end - in)) {
+            return false;
+        }
+        i += zeros;
+        for (size_t c = 0; c < literals; c++) {
+            frame[i++] ^= *in++;
+        }
+    }
+    return true;
+}
+#endif
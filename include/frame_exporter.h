@@ -0,0 +1,192 @@
+#ifndef FRAME_EXPORTER_H
+#define FRAME_EXPORTER_H
+
+#include <../include/png_encoder.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum ExportFormat {
+    // one numbered PNG file per frame
+    EXPORT_PNG,
+    // every frame appended to one file of raw top-down RGBA8 frames, e.g. for
+    // ffmpeg -f rawvideo -pix_fmt rgba -s WIDTHxHEIGHT -i frames.rgba
+    EXPORT_RAW
+};
+
+// writes frames out on a pool of worker threads so the simulation never waits on
+// compression or the disk. submit() copies the frame into a free buffer and queues it;
+// at most queueCapacity frames are in flight, and when they're all taken the frame is
+// dropped and counted instead of blocking the caller
+class FrameExporter
+{
+public:
+    FrameExporter(const std::string &directory, ExportFormat format, unsigned int width, unsigned int height,
+                  unsigned int workers, size_t queueCapacity)
+        : directory(directory), format(format), width(width), height(height), queueCapacity(queueCapacity),
+          buffersAllocated(0), stopping(false), rawFile(NULL), exported(0), dropped(0), failed(0), started(false)
+    {
+        if (format == EXPORT_RAW) {
+            std::string path = directory + "/frames.rgba";
+            rawFile = fopen(path.c_str(), "wb");
+            if (rawFile == NULL) {
+                std::cout << "Failed to open " << path << " for export" << std::endl;
+            }
+            // a raw stream has to be written in frame order
+            workers = 1;
+        }
+        if (workers == 0) {
+            workers = 1;
+        }
+        for (unsigned int i = 0; i < workers; i++) {
+            threads.push_back(std::thread(&FrameExporter::work, this));
+        }
+    }
+
+    ~FrameExporter()
+    {
+        finish();
+    }
+
+    // queue a frame given with row 0 at the bottom and rows rowLength pixels apart, as
+    // Simulation::pixels() hands them out. returns false if it had to be dropped
+    bool submit(const uint32_t *pixels, size_t rowLength, unsigned int frameNumber)
+    {
+        std::vector<uint32_t> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!started) {
+                startTime = std::chrono::steady_clock::now();
+                started = true;
+            }
+            if (!freeBuffers.empty()) {
+                buffer.swap(freeBuffers.back());
+                freeBuffers.pop_back();
+            } else if (buffersAllocated < queueCapacity) {
+                buffersAllocated++;
+            } else {
+                dropped++;
+                return false;
+            }
+        }
+
+        // images are stored top row first
+        buffer.resize((size_t)width * height);
+        for (unsigned int y = 0; y < height; y++) {
+            std::memcpy(&buffer[(size_t)(height - 1 - y) * width], pixels + y * rowLength, width * sizeof(uint32_t));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(Frame());
+            queue.back().number = frameNumber;
+            queue.back().pixels.swap(buffer);
+        }
+        frameQueued.notify_one();
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    // wait for everything queued to be written, stop the workers and report throughput
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            stopping = true;
+        }
+        frameQueued.notify_all();
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        if (rawFile != NULL) {
+            fclose(rawFile);
+        }
+
+        if (started) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            char report[160];
+            snprintf(report, sizeof(report), "Exported %u frames in %.2f s (%.1f frames/s), %u dropped, %u failed",
+                     exported, seconds, seconds > 0 ? exported / seconds : 0.0, dropped, failed);
+            std::cout << report << std::endl;
+        }
+    }
+
+private:
+    struct Frame {
+        unsigned int number;
+        std::vector<uint32_t> pixels;
+    };
+
+    std::string directory;
+    ExportFormat format;
+    unsigned int width;
+    unsigned int height;
+    size_t queueCapacity;
+    size_t buffersAllocated;
+
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::deque<Frame> queue;
+    std::vector<std::vector<uint32_t> > freeBuffers;
+    bool stopping;
+    std::vector<std::thread> threads;
+    FILE *rawFile;
+
+    // reporting, guarded by the mutex
+    unsigned int exported;
+    unsigned int dropped;
+    unsigned int failed;
+    bool started;
+    std::chrono::steady_clock::time_point startTime;
+
+    void work()
+    {
+        for (;;) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameQueued.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                frame.number = queue.front().number;
+                frame.pixels.swap(queue.front().pixels);
+                queue.pop_front();
+            }
+
+            bool written = write(frame);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (written) {
+                exported++;
+            } else {
+                failed++;
+            }
+            freeBuffers.push_back(std::vector<uint32_t>());
+            freeBuffers.back().swap(frame.pixels);
+        }
+    }
+    // ------------------------------------------------------------------------
+    bool write(const Frame &frame)
+    {
+        if (format == EXPORT_RAW) {
+            size_t bytes = frame.pixels.size() * sizeof(uint32_t);
+            return rawFile != NULL && fwrite(frame.pixels.data(), 1, bytes, rawFile) == bytes;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06u.png", frame.number);
+        return writePng(directory + name, frame.pixels.data(), width, height, width);
+    }
+};
+#endif
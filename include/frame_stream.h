@@ -0,0 +1,422 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <../include/color_output.h>
+#include <../include/frame_delta.h>
+#include <../include/simulation.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// frames of a running simulation published to viewers over a unix domain socket.
+// what goes over the wire is the material grid, one byte a cell, not the colors: a
+// viewer can color it itself, and most cells keep their material from one tick to the
+// next, so each frame is sent coded against the one before (see encodeFrameDelta).
+//
+// the stream is a header of 4 words (FRAME_STREAM_MAGIC, FRAME_STREAM_VERSION, width,
+// height), then frames of 3 words (tick, kind, payload bytes) followed by the payload.
+// words are 32 bit little endian. a key frame is coded against an all empty grid
+// (material 0), a delta frame against the frame sent just before it
+
+const uint32_t FRAME_STREAM_MAGIC = 0x53444e53;   // "SNDS"
+const uint32_t FRAME_STREAM_VERSION = 1;
+
+// bytes a slow viewer may have queued before it skips frames. it gets a key frame once
+// it has caught up again
+const size_t FRAME_STREAM_MAX_BACKLOG = 16 * 1024 * 1024;
+// how long a viewer's update() waits for the next frame before it lets the window
+// handle its events
+const int FRAME_STREAM_WAIT_MS = 10;
+
+// publishes frames to every viewer connected to a socket path. publish() never blocks:
+// viewers are accepted and written to without waiting, and a viewer that can't keep up
+// skips frames rather than holding up the simulation
+class FrameStreamServer
+{
+public:
+    FrameStreamServer(const std::string &path, unsigned int width, unsigned int height)
+        : path(path), width(width), height(height), cells((size_t)width * height), previous(cells), current(cells),
+          listener(-1), framesSent(0), bytesSent(0), skipped(0), lastTick(0)
+    {
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cout << "Socket path too long: " << path << std::endl;
+            return;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        // a socket file left behind by an earlier run would make bind fail
+        unlink(path.c_str());
+        if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+            std::cout << "Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+            if (listener >= 0) {
+                close(listener);
+                listener = -1;
+            }
+            return;
+        }
+        std::cout << "Streaming frames on " << path << std::endl;
+    }
+
+    ~FrameStreamServer()
+    {
+        for (size_t c = 0; c < clients.size(); c++) {
+            close(clients[c].fd);
+        }
+        if (listener >= 0) {
+            close(listener);
+            unlink(path.c_str());
+        }
+    }
+
+    bool listening() const
+    {
+        return listener >= 0;
+    }
+    // ------------------------------------------------------------------------
+    // send the simulation's current world to every viewer
+    void publish(const Simulation &simulation, unsigned int tick)
+    {
+        if (!listening()) {
+            return;
+        }
+        acceptClients();
+        simulation.copyMaterials(current.data());
+
+        // coded once for everyone who needs it, an unchanged world codes to nothing
+        std::string delta, key;
+        bool deltaCoded = false, keyCoded = false;
+        for (size_t c = 0; c < clients.size();) {
+            Client &client = clients[c];
+            if (!flush(client)) {
+                dropClient(c);
+                continue;
+            }
+            if (client.pending.size() - client.sent > FRAME_STREAM_MAX_BACKLOG) {
+                // it'll miss this frame, so the next one it gets can't be a delta
+                client.needsKeyFrame = true;
+                skipped++;
+                c++;
+                continue;
+            }
+
+            FrameKind kind = client.needsKeyFrame ? FRAME_KEY : FRAME_DELTA;
+            std::string &payload = kind == FRAME_KEY ? key : delta;
+            bool &coded = kind == FRAME_KEY ? keyCoded : deltaCoded;
+            if (!coded) {
+                encodeFrameDelta(kind == FRAME_KEY ? NULL : previous.data(), current.data(), cells, payload);
+                coded = true;
+            }
+            queueFrame(client, tick, kind, payload);
+            if (!flush(client)) {
+                dropClient(c);
+                continue;
+            }
+            c++;
+        }
+        previous.swap(current);
+        lastTick = tick;
+    }
+    // ------------------------------------------------------------------------
+    // wait up to timeoutMs for the viewers to take what's still queued for them, e.g.
+    // before the simulation exits
+    void finish(int timeoutMs)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        std::string key;
+        for (size_t c = 0; c < clients.size(); c++) {
+            Client &client = clients[c];
+            // a viewer that skipped the last frames gets the final world as a key frame
+            if (drain(client, deadline) && client.needsKeyFrame) {
+                if (key.empty()) {
+                    encodeFrameDelta(NULL, previous.data(), cells, key);
+                }
+                queueFrame(client, lastTick, FRAME_KEY, key);
+                drain(client, deadline);
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    std::string report() const
+    {
+        char line[160];
+        double rawBytes = (double)framesSent * cells;
+        snprintf(line, sizeof(line), "%llu frames streamed in %.1f MB, %.1f%% of the raw grids, %llu skipped by slow viewers",
+                 (unsigned long long)framesSent, bytesSent / 1e6, rawBytes > 0 ? 100.0 * bytesSent / rawBytes : 0.0,
+                 (unsigned long long)skipped);
+        return line;
+    }
+
+private:
+    struct Client {
+        int fd;
+        // bytes queued for the viewer, the first sent of them are already out
+        std::string pending;
+        size_t sent;
+        bool needsKeyFrame;
+    };
+
+    std::string path;
+    unsigned int width;
+    unsigned int height;
+    size_t cells;
+    // the frame the viewers have and the one being sent
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> current;
+    int listener;
+    std::vector<Client> clients;
+    uint64_t framesSent;
+    uint64_t bytesSent;
+    uint64_t skipped;
+    // tick of the last frame published
+    unsigned int lastTick;
+
+    void acceptClients()
+    {
+        while (true) {
+            int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            Client client = { fd, std::string(), 0, true };
+            appendWord(client.pending, FRAME_STREAM_MAGIC);
+            appendWord(client.pending, FRAME_STREAM_VERSION);
+            appendWord(client.pending, width);
+            appendWord(client.pending, height);
+            clients.push_back(client);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // send as much of what's queued as the socket takes right now. false once the
+    // viewer has gone
+    bool flush(Client &client)
+    {
+        while (client.sent < client.pending.size()) {
+            ssize_t written = send(client.fd, client.pending.data() + client.sent, client.pending.size() - client.sent,
+                                   MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            client.sent += written;
+            bytesSent += written;
+        }
+        client.pending.clear();
+        client.sent = 0;
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    void queueFrame(Client &client, unsigned int tick, FrameKind kind, const std::string &payload)
+    {
+        appendWord(client.pending, tick);
+        appendWord(client.pending, kind);
+        appendWord(client.pending, (uint32_t)payload.size());
+        client.pending += payload;
+        client.needsKeyFrame = false;
+        framesSent++;
+    }
+    // ------------------------------------------------------------------------
+    // flush until everything queued is out or the deadline passes. true if it all went
+    bool drain(Client &client, std::chrono::steady_clock::time_point deadline)
+    {
+        while (flush(client) && client.sent < client.pending.size()) {
+            int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            pollfd writable = { client.fd, POLLOUT, 0 };
+            if (left <= 0 || poll(&writable, 1, left) <= 0) {
+                break;
+            }
+        }
+        return client.sent == client.pending.size();
+    }
+    // ------------------------------------------------------------------------
+    void dropClient(size_t c)
+    {
+        close(clients[c].fd);
+        clients.erase(clients.begin() + c);
+    }
+};
+
+// the window's side of the stream: a simulation whose world comes from a server. update()
+// applies whatever frames have arrived, drawing into it does nothing
+class StreamedWorld : public Simulation
+{
+public:
+    ~StreamedWorld()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // connect to the server on path and read its header. NULL if that fails
+    static std::unique_ptr<StreamedWorld> connect(const std::string &path)
+    {
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cout << "Socket path too long: " << path << std::endl;
+            return std::unique_ptr<StreamedWorld>();
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unsigned char header[16];
+        size_t received = 0;
+        if (fd >= 0 && ::connect(fd, (sockaddr *)&address, sizeof(address)) == 0) {
+            while (received < sizeof(header)) {
+                ssize_t count = recv(fd, header + received, sizeof(header) - received, 0);
+                if (count <= 0 && !(count < 0 && errno == EINTR)) {
+                    break;
+                }
+                received += count > 0 ? count : 0;
+            }
+        }
+        if (received < sizeof(header) || readWord(header) != FRAME_STREAM_MAGIC ||
+            readWord(header + 4) != FRAME_STREAM_VERSION || readWord(header + 8) < 2 || readWord(header + 12) < 2) {
+            std::cout << "Failed to connect to a frame stream on " << path << std::endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return std::unique_ptr<StreamedWorld>();
+        }
+        return std::unique_ptr<StreamedWorld>(new StreamedWorld(fd, readWord(header + 8), readWord(header + 12)));
+    }
+
+    unsigned int width() const { return w; }
+    unsigned int height() const { return h; }
+    void draw(double xpos, double ypos, int particleType) {}
+    // ------------------------------------------------------------------------
+    bool update()
+    {
+        if (fd < 0) {
+            return false;
+        }
+        pollfd readable = { fd, POLLIN, 0 };
+        if (poll(&readable, 1, FRAME_STREAM_WAIT_MS) <= 0) {
+            return false;
+        }
+        // everything that has arrived so far
+        unsigned char buffer[64 * 1024];
+        bool ended = false;
+        while (true) {
+            ssize_t count = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (count > 0) {
+                inbox.insert(inbox.end(), buffer, buffer + count);
+                continue;
+            }
+            ended = count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+            if (ended || errno != EINTR) {
+                break;
+            }
+        }
+
+        bool changed = false;
+        size_t used = 0;
+        while (inbox.size() - used >= 12) {
+            const unsigned char *frame = inbox.data() + used;
+            uint32_t kind = readWord(frame + 4);
+            size_t length = readWord(frame + 8);
+            if (inbox.size() - used - 12 < length) {
+                break;
+            }
+            if (kind == FRAME_KEY) {
+                std::fill(materials.begin(), materials.end(), 0);
+            }
+            if ((kind != FRAME_KEY && kind != FRAME_DELTA) ||
+                !decodeFrameDelta(frame + 12, length, materials.data(), materials.size())) {
+                std::cout << "Malformed frame after tick " << lastTick << ", disconnecting" << std::endl;
+                close(fd);
+                fd = -1;
+                inbox.clear();
+                return changed;
+            }
+            lastTick = readWord(frame);
+            used += 12 + length;
+            changed = true;
+        }
+        inbox.erase(inbox.begin(), inbox.begin() + used);
+        if (ended) {
+            std::cout << "Frame stream ended after tick " << lastTick << std::endl;
+            close(fd);
+            fd = -1;
+        }
+
+        if (changed) {
+            // the stream carries no color variation, every cell of a material is drawn alike
+            colorMaterials(materials.data(), materials.size(), colors.data());
+        }
+        return changed;
+    }
+    // ------------------------------------------------------------------------
+    // a world nobody streams to anymore won't change again
+    bool settled() const
+    {
+        return fd < 0;
+    }
+    // ------------------------------------------------------------------------
+    const Rgba8 *pixels() const
+    {
+        return colors.data();
+    }
+    // ------------------------------------------------------------------------
+    int pixelRowLength() const
+    {
+        return w;
+    }
+    // ------------------------------------------------------------------------
+    int material(unsigned int x, unsigned int y) const
+    {
+        return materials[(size_t)y * w + x];
+    }
+    // ------------------------------------------------------------------------
+    // the same hash hashMaterials gives the world on the server
+    uint64_t materialHash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < materials.size(); i++) {
+            hash = (hash ^ materials[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+    // ------------------------------------------------------------------------
+    void copyMaterials(unsigned char *out) const
+    {
+        std::copy(materials.begin(), materials.end(), out);
+    }
+
+private:
+    StreamedWorld(int fd, unsigned int width, unsigned int height)
+        : fd(fd), w(width), h(height), materials((size_t)width * height, 0), colors((size_t)width * height), lastTick(0)
+    {
+        const ColorTable &table = colorTable();
+        std::fill(colors.begin(), colors.end(), table.color(EMPTY, 0));
+    }
+
+    int fd;
+    unsigned int w;
+    unsigned int h;
+    std::vector<unsigned char> materials;
+    std::vector<Rgba8> colors;
+    // received but not yet complete frames
+    std::vector<unsigned char> inbox;
+    uint32_t lastTick;
+};
+#endif
@@ -0,0 +1,123 @@
+#ifndef FREE_PARTICLES_H
+#define FREE_PARTICLES_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// particles flying free of the grid, e.g. the spray of a splash or what a blast throws
+// around. a cell moves at most one step per tick on the grid, however fast it's meant
+// to be going; up here a particle has a position and velocity of its own, so a fast one
+// costs one update per tick instead of a chain of swaps. particles are lifted out of
+// the grid when something hits them hard and put back into it where they land, from
+// then on the grid's rules take over again. while in the air they're not part of the
+// world's materials (materialHash, copyMaterials), only drawn over it.
+// stored as a structure of arrays so integrate() streams plain float arrays
+
+// cells per tick squared
+const float FREE_PARTICLE_GRAVITY = 0.25f;
+// cells per tick along either axis, the most a particle crosses in one tick
+const float MAX_FREE_PARTICLE_SPEED = 8.0f;
+// particles in the air at once, lifting more than that leaves the cells in the grid
+const size_t MAX_FREE_PARTICLES = 65536;
+// a particle landing in a liquid at least this fast splashes it up
+const float SPLASH_SPEED = 3.0f;
+// share of the landing particle's speed the splashed liquid flies off with
+const float SPLASH_RESTITUTION = 0.5f;
+// cells around its center a blast lifts, the speed it gives those next to the center and
+// what it adds upwards to everything
+const float BLAST_RADIUS = 12.0f;
+const float BLAST_SPEED = 6.0f;
+const float BLAST_LIFT = 2.0f;
+
+// cells a particle whose cell filled up under it looks through for an empty one before
+// it waits a tick for room, see findLanding
+const size_t LANDING_SEARCH_CELLS = 4096;
+
+// what findLanding keeps between searches
+struct LandingSearch {
+    // the search that last queued a cell, y * width + x
+    std::vector<unsigned int> queuedBy;
+    unsigned int search = 0;
+    std::vector<int> queue;
+};
+
+class FreeParticles
+{
+public:
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    // a particle at (x, y) in cells, (0, 0) the bottom left corner of the world. false if
+    // there are too many in the air already
+    bool add(float px, float py, float pvx, float pvy, unsigned char particleType, signed char variation)
+    {
+        if (x.size() >= MAX_FREE_PARTICLES) {
+            return false;
+        }
+        x.push_back(px);
+        y.push_back(py);
+        vx.push_back(clampSpeed(pvx));
+        vy.push_back(clampSpeed(pvy));
+        fromX.push_back(px);
+        fromY.push_back(py);
+        material.push_back(particleType);
+        colorVariation.push_back(variation);
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    // one tick of flight for every particle, ignoring what's in the way. where each one
+    // started from is kept in fromX/fromY for tracing its path afterwards
+    void integrate()
+    {
+        size_t count = x.size();
+        float *px = x.data(), *py = y.data(), *pvx = vx.data(), *pvy = vy.data();
+        float *startX = fromX.data(), *startY = fromY.data();
+        for (size_t p = 0; p < count; p++) {
+            startX[p] = px[p];
+            startY[p] = py[p];
+            pvy[p] = std::max(pvy[p] - FREE_PARTICLE_GRAVITY, -MAX_FREE_PARTICLE_SPEED);
+            px[p] += pvx[p];
+            py[p] += pvy[p];
+        }
+    }
+    // ------------------------------------------------------------------------
+    // drop particle p, the last one takes its place
+    void remove(size_t p)
+    {
+        size_t last = x.size() - 1;
+        x[p] = x[last];
+        y[p] = y[last];
+        vx[p] = vx[last];
+        vy[p] = vy[last];
+        fromX[p] = fromX[last];
+        fromY[p] = fromY[last];
+        material[p] = material[last];
+        colorVariation[p] = colorVariation[last];
+        x.pop_back();
+        y.pop_back();
+        vx.pop_back();
+        vy.pop_back();
+        fromX.pop_back();
+        fromY.pop_back();
+        material.pop_back();
+        colorVariation.pop_back();
+    }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    // position before the last integrate()
+    std::vector<float> fromX;
+    std::vector<float> fromY;
+    std::vector<unsigned char> material;
+    std::vector<signed char> colorVariation;
+
+private:
+    static float clampSpeed(float speed)
+    {
+        return std::min(std::max(speed, -MAX_FREE_PARTICLE_SPEED), MAX_FREE_PARTICLE_SPEED);
+    }
+};
+#endif
@@ -0,0 +1,179 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <../include/engines.h>
+#include <../include/scenes.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// golden-state regression harness. every canonical scene is run for its tick count and
+// the material hash of the world after each tick is stored in a reference file; any
+// engine can then be run through the same scenes and checked against it tick by tick.
+// the file is plain text so changes to it show up in review:
+//   scene NAME WIDTH HEIGHT TICKS
+//   HASH            (one hex line per tick)
+
+// engine the references are recorded with, and replayed to find the first differing cell
+// once another engine diverges. scenes can name another one, see Scene::recordedOn
+const char *const GOLDEN_REFERENCE_ENGINE = "reference";
+
+// material hash after every tick of a scene
+inline std::vector<uint64_t> sceneHashes(Simulation &simulation, const Scene &scene)
+{
+    std::vector<uint64_t> hashes;
+    hashes.reserve(scene.ticks);
+    for (unsigned int tick = 0; tick < scene.ticks; tick++) {
+        scene.input(simulation, tick);
+        simulation.update();
+        hashes.push_back(simulation.materialHash());
+    }
+    return hashes;
+}
+
+inline bool recordGolden(const std::string &path)
+{
+    std::ofstream file(path.c_str());
+    if (!file) {
+        std::cout << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    for (int s = 0; s < SCENE_COUNT; s++) {
+        const Scene &scene = SCENES[s];
+        std::unique_ptr<Simulation> simulation = makeSimulation(scene.width, scene.height, scene.recordedOn);
+        std::vector<uint64_t> hashes = sceneHashes(*simulation, scene);
+
+        file << "scene " << scene.name << " " << scene.width << " " << scene.height << " " << scene.ticks << "\n";
+        for (size_t tick = 0; tick < hashes.size(); tick++) {
+            char line[24];
+            snprintf(line, sizeof(line), "%016" PRIx64 "\n", hashes[tick]);
+            file << line;
+        }
+        std::cout << scene.name << ": recorded " << hashes.size() << " ticks" << std::endl;
+    }
+    return true;
+}
+
+// reference hashes by scene name
+inline bool loadGolden(const std::string &path, std::map<std::string, std::vector<uint64_t> > &references)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        std::cout << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    std::vector<uint64_t> *hashes = NULL;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 6, "scene ") == 0) {
+            std::istringstream header(line.substr(6));
+            std::string name;
+            header >> name;
+            hashes = &references[name];
+        } else if (hashes != NULL && !line.empty()) {
+            hashes->push_back(strtoull(line.c_str(), NULL, 16));
+        }
+    }
+    return true;
+}
+
+// run one scene on an engine against its references. reports the first tick whose hash
+// differs and, by replaying the reference engine up to that tick, the first differing cell
+inline bool checkScene(const Scene &scene, const std::string &engine, const std::vector<uint64_t> &references)
+{
+    if (references.size() != scene.ticks) {
+        std::cout << scene.name << ": reference has " << references.size() << " ticks, scene runs "
+                  << scene.ticks << ", re-record it" << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<Simulation> simulation = makeSimulation(scene.width, scene.height, engine);
+    unsigned int tick = 0;
+    for (; tick < scene.ticks; tick++) {
+        scene.input(*simulation, tick);
+        simulation->update();
+        if (simulation->materialHash() != references[tick]) {
+            break;
+        }
+    }
+    if (tick == scene.ticks) {
+        // a world that should have come to rest, but keeps doing work every tick
+        unsigned int waited = 0;
+        for (; waited < scene.settlesWithin && !simulation->settled(); waited++) {
+            simulation->update();
+        }
+        if (scene.settlesWithin > 0 && !simulation->settled()) {
+            std::cout << scene.name << ": matched, but not settled " << waited << " ticks after its input" << std::endl;
+            return false;
+        }
+        std::cout << scene.name << ": ok, " << scene.ticks << " ticks" << std::endl;
+        return true;
+    }
+
+    std::cout << scene.name << ": diverged at tick " << tick << std::endl;
+
+    std::unique_ptr<Simulation> reference = makeSimulation(scene.width, scene.height, scene.recordedOn);
+    for (unsigned int replayed = 0; replayed <= tick; replayed++) {
+        scene.input(*reference, replayed);
+        reference->update();
+    }
+    if (reference->materialHash() != references[tick]) {
+        std::cout << "  the " << scene.recordedOn << " engine doesn't match the reference at that tick"
+                  << " either, no cell to compare against" << std::endl;
+        return false;
+    }
+
+    for (unsigned int y = 0; y < scene.height; y++) {
+        for (unsigned int x = 0; x < scene.width; x++) {
+            int expected = reference->material(x, y);
+            int actual = simulation->material(x, y);
+            if (expected != actual) {
+                std::cout << "  first differing cell (" << x << ", " << y << "): expected "
+                          << materialDefinitions[expected].name << ", got " << materialDefinitions[actual].name << std::endl;
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+// check an engine against every scene in a reference file, true if all of them match
+inline bool checkGolden(const std::string &path, const std::string &engine)
+{
+    if (hasOwnRules(engine)) {
+        std::cout << "engine " << engine << " doesn't follow the reference's rules, the golden hashes don't apply."
+                  << " fuzz it against " << oracleName(engine) << " instead" << std::endl;
+        return false;
+    }
+    std::map<std::string, std::vector<uint64_t> > references;
+    if (!loadGolden(path, references)) {
+        return false;
+    }
+
+    bool passed = true;
+    for (int s = 0; s < SCENE_COUNT; s++) {
+        const Scene &scene = SCENES[s];
+        if (engine == GOLDEN_REFERENCE_ENGINE && scene.recordedOn != engine) {
+            std::cout << scene.name << ": skipped, the " << engine << " engine has no heat or free particles" << std::endl;
+            continue;
+        }
+        if (references.find(scene.name) == references.end()) {
+            std::cout << scene.name << ": no reference recorded" << std::endl;
+            passed = false;
+            continue;
+        }
+        passed = checkScene(scene, engine, references[scene.name]) && passed;
+    }
+    std::cout << (passed ? "golden check passed for engine " : "golden check FAILED for engine ") << engine << std::endl;
+    return passed;
+}
+#endif
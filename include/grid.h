@@ -0,0 +1,278 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <../include/grid_memory.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// grids whose size is only known at runtime use this for both dimensions
+const unsigned int DYNAMIC_EXTENT = 0;
+
+// width and height of a grid. for sizes known at compile time these are constants,
+// so every stride the kernels use folds into their address math
+template <unsigned int W, unsigned int H>
+class GridExtent
+{
+public:
+    GridExtent(unsigned int width, unsigned int height) {}
+
+    static constexpr unsigned int width() { return W; }
+    static constexpr unsigned int height() { return H; }
+};
+
+// runtime sized fallback, same interface with the dimensions stored as members
+template <>
+class GridExtent<DYNAMIC_EXTENT, DYNAMIC_EXTENT>
+{
+public:
+    GridExtent(unsigned int width, unsigned int height) : w(width), h(height) {}
+
+    unsigned int width() const { return w; }
+    unsigned int height() const { return h; }
+
+private:
+    unsigned int w;
+    unsigned int h;
+};
+
+// how a new grid's memory gets its first write. the kernel places each page on the NUMA
+// node of the thread that first writes it, so grids that are going to be worked on by
+// several threads can be left unfilled by the constructor and filled by those threads
+enum GridFill {
+    // filled by the constructing thread
+    GRID_FILL_NOW,
+    // left for fillColumns() from the owning threads
+    GRID_FILL_LATER,
+    // the same, and kept off huge pages: a 2 MB page spans whole rows of a big grid, so
+    // it can't be split between threads on different nodes
+    GRID_FILL_LATER_SMALL_PAGES
+};
+
+// hands the first fill of GRID_FILL_LATER grids to the threads that will own the cells.
+// touchColumns calls fill with ranges of padded columns (the border is column 0 and
+// width + 1) that together cover 0..paddedWidth, each on the thread owning that range
+class GridFirstTouch
+{
+public:
+    virtual ~GridFirstTouch() {}
+
+    virtual void touchColumns(unsigned int paddedWidth, const std::function<void(unsigned int, unsigned int)> &fill) const = 0;
+    // whether the owning threads sit on different NUMA nodes
+    virtual bool spansNodes() const = 0;
+};
+
+inline GridFill gridFill(const GridFirstTouch *firstTouch)
+{
+    if (firstTouch == NULL) {
+        return GRID_FILL_NOW;
+    }
+    return firstTouch->spansNodes() ? GRID_FILL_LATER_SMALL_PAGES : GRID_FILL_LATER;
+}
+
+// layouts map interior (x, y) coordinates to a storage index and step from a cell to
+// its neighbours. both include a one-cell border around the interior, so (x, y) = (0, 0)
+// is stored at padded position (1, 1) and every neighbour of an interior cell exists.
+
+// plain rows of width + 2 cells one after another
+template <unsigned int W, unsigned int H>
+class RowMajorLayout : public GridExtent<W, H>
+{
+public:
+    // rows are contiguous and stride() cells apart
+    static const bool ROW_MAJOR = true;
+
+    RowMajorLayout(unsigned int width, unsigned int height) : GridExtent<W, H>(width, height) {}
+
+    int stride() const { return (int)this->width() + 2; }
+    // cells in storage, border included
+    size_t size() const { return (size_t)stride() * (this->height() + 2); }
+
+    int index(unsigned int x, unsigned int y) const { return paddedIndex(x + 1, y + 1); }
+    // position counted from the bottom left border cell
+    int paddedIndex(unsigned int paddedX, unsigned int paddedY) const { return (int)(paddedY * stride() + paddedX); }
+    unsigned int column(int i) const { return (unsigned int)i % (unsigned int)stride() - 1; }
+    unsigned int row(int i) const { return (unsigned int)i / (unsigned int)stride() - 1; }
+
+    // neighbours of cell i
+    // ------------------------------------------------------------------------
+    int up(int i) const { return i + stride(); }
+    int down(int i) const { return i - stride(); }
+    int left(int i) const { return i - 1; }
+    int right(int i) const { return i + 1; }
+    int upLeft(int i) const { return i + stride() - 1; }
+    int upRight(int i) const { return i + stride() + 1; }
+    int downLeft(int i) const { return i - stride() - 1; }
+    int downRight(int i) const { return i - stride() + 1; }
+};
+
+// 8x8 tiles of cells stored contiguously, tiles in row-major order. the cell below is
+// usually 8 cells away in the same tile instead of a whole row away, so on very wide
+// grids the rows a sweep reads around the current one stay in cache. stepping across a
+// tile edge is a select rather than a branch
+template <unsigned int W, unsigned int H>
+class TiledLayout : public GridExtent<W, H>
+{
+public:
+    static const bool ROW_MAJOR = false;
+    static const int TILE_SHIFT = 3;
+    static const int TILE_SIZE = 1 << TILE_SHIFT;
+    static const int TILE_CELLS = TILE_SIZE * TILE_SIZE;
+
+    TiledLayout(unsigned int width, unsigned int height) : GridExtent<W, H>(width, height) {}
+
+    int tilesPerRow() const { return ((int)this->width() + 2 + TILE_SIZE - 1) >> TILE_SHIFT; }
+    int tileRowStride() const { return tilesPerRow() * TILE_CELLS; }
+    // cells in storage, border and the unused end of partial tiles included
+    size_t size() const
+    {
+        return (size_t)tileRowStride() * (((int)this->height() + 2 + TILE_SIZE - 1) >> TILE_SHIFT);
+    }
+
+    int index(unsigned int x, unsigned int y) const { return paddedIndex(x + 1, y + 1); }
+    // position counted from the bottom left border cell
+    int paddedIndex(unsigned int paddedX, unsigned int paddedY) const
+    {
+        int tile = (int)((paddedY >> TILE_SHIFT) * tilesPerRow() + (paddedX >> TILE_SHIFT));
+        return tile * TILE_CELLS + (int)((paddedY & (TILE_SIZE - 1)) << TILE_SHIFT) + (int)(paddedX & (TILE_SIZE - 1));
+    }
+    unsigned int column(int i) const
+    {
+        unsigned int tile = (unsigned int)i / TILE_CELLS;
+        return (tile % tilesPerRow()) * TILE_SIZE + (i & (TILE_SIZE - 1)) - 1;
+    }
+    unsigned int row(int i) const
+    {
+        unsigned int tile = (unsigned int)i / TILE_CELLS;
+        return (tile / tilesPerRow()) * TILE_SIZE + ((i >> TILE_SHIFT) & (TILE_SIZE - 1)) - 1;
+    }
+
+    // neighbours of cell i
+    // ------------------------------------------------------------------------
+    int up(int i) const
+    {
+        bool topOfTile = (i & (TILE_CELLS - TILE_SIZE)) == TILE_CELLS - TILE_SIZE;
+        return topOfTile ? i + tileRowStride() - (TILE_CELLS - TILE_SIZE) : i + TILE_SIZE;
+    }
+    int down(int i) const
+    {
+        bool bottomOfTile = (i & (TILE_CELLS - TILE_SIZE)) == 0;
+        return bottomOfTile ? i - tileRowStride() + (TILE_CELLS - TILE_SIZE) : i - TILE_SIZE;
+    }
+    int left(int i) const
+    {
+        bool leftOfTile = (i & (TILE_SIZE - 1)) == 0;
+        return leftOfTile ? i - TILE_CELLS + (TILE_SIZE - 1) : i - 1;
+    }
+    int right(int i) const
+    {
+        bool rightOfTile = (i & (TILE_SIZE - 1)) == TILE_SIZE - 1;
+        return rightOfTile ? i + TILE_CELLS - (TILE_SIZE - 1) : i + 1;
+    }
+    int upLeft(int i) const { return left(up(i)); }
+    int upRight(int i) const { return right(up(i)); }
+    int downLeft(int i) const { return left(down(i)); }
+    int downRight(int i) const { return right(down(i)); }
+};
+
+// 2D grid of cells with row 0 at the bottom, matching the texture orientation.
+// the kernels only ever move around it through index() and the neighbour helpers of
+// the layout, so the same kernel code runs on a Grid<Cell, 837, 600> with constant
+// strides, on a runtime sized Grid<Cell>, and on either memory layout.
+// storage has a one-cell border of sentinel cells all the way around the width x height
+// interior, so every neighbour of an interior cell is in bounds by construction and a
+// row never wraps into the next one. kernels don't need any edge checks.
+// cells live in memory from allocateGridMemory, on huge pages for big grids unless the
+// grid is filled later by threads on different NUMA nodes
+template <typename Cell, unsigned int W = DYNAMIC_EXTENT, unsigned int H = DYNAMIC_EXTENT,
+          template <unsigned int, unsigned int> class Layout = RowMajorLayout>
+class Grid : public Layout<W, H>
+{
+    // cells are raw memory filled in place, never constructed or destroyed
+    static_assert(std::is_trivial<Cell>::value, "grid cells must be trivial types");
+
+public:
+    typedef Cell CellType;
+    // a grid with the same shape and layout holding a different cell type, used for
+    // per-cell side data
+    template <typename Other>
+    using Rebind = Grid<Other, W, H, Layout>;
+
+    Grid(unsigned int width = W, unsigned int height = H, const Cell &border = Cell(), GridFill fillMode = GRID_FILL_NOW)
+        : Layout<W, H>(width, height)
+    {
+        GridMemoryDeleter deleter;
+        void *memory = allocateGridMemory(this->size() * sizeof(Cell), deleter, fillMode != GRID_FILL_LATER_SMALL_PAGES);
+        cells = std::unique_ptr<Cell[], GridMemoryDeleter>((Cell *)memory, deleter);
+
+        if (fillMode == GRID_FILL_NOW) {
+            fill(border);
+            fillInterior(Cell());
+        }
+    }
+
+    Cell &operator[](int i) { return cells[i]; }
+    const Cell &operator[](int i) const { return cells[i]; }
+    Cell *data() { return cells.get(); }
+    const Cell *data() const { return cells.get(); }
+
+    void fill(const Cell &value)
+    {
+        std::fill(cells.get(), cells.get() + this->size(), value);
+    }
+    // ------------------------------------------------------------------------
+    // fill everything inside the border, leaving the sentinels alone
+    void fillInterior(const Cell &value)
+    {
+        fillInterior(value, 0, this->width());
+    }
+    // ------------------------------------------------------------------------
+    // only interior columns firstColumn..lastColumn-1 of every row
+    void fillInterior(const Cell &value, unsigned int firstColumn, unsigned int lastColumn)
+    {
+        for (unsigned int y = 0; y < this->height(); y++) {
+            int i = this->index(firstColumn, y);
+            for (unsigned int x = firstColumn; x < lastColumn; x++, i = this->right(i)) {
+                cells[i] = value;
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // only interior rows firstRow..lastRow-1
+    void fillInteriorRows(const Cell &value, unsigned int firstRow, unsigned int lastRow)
+    {
+        for (unsigned int y = firstRow; y < lastRow; y++) {
+            int i = this->index(0, y);
+            for (unsigned int x = 0; x < this->width(); x++, i = this->right(i)) {
+                cells[i] = value;
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // first fill of padded columns firstColumn..lastColumn-1 of a GRID_FILL_LATER grid,
+    // border cells included
+    void fillColumns(unsigned int firstColumn, unsigned int lastColumn, const Cell &border, const Cell &interior)
+    {
+        for (unsigned int y = 0; y < this->height() + 2; y++) {
+            bool borderRow = y == 0 || y == this->height() + 1;
+            for (unsigned int x = firstColumn; x < lastColumn; x++) {
+                bool borderCell = borderRow || x == 0 || x == this->width() + 1;
+                cells[this->paddedIndex(x, y)] = borderCell ? border : interior;
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // exchange contents with a grid of the same size, used to flip double buffers
+    void swap(Grid &other)
+    {
+        std::swap(cells, other.cells);
+    }
+
+private:
+    std::unique_ptr<Cell[], GridMemoryDeleter> cells;
+};
+#endif
@@ -0,0 +1,171 @@
+#ifndef GRID_MEMORY_H
+#define GRID_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// backing memory for grid cells. a 16K x 16K grid is 256 MB a plane, and a sweep reading
+// the row below touches a new 4 KB page every few cells, so on big worlds the TLB misses
+// on vertical neighbours add up. grids of at least a huge page get 2 MB pages when the
+// system has them: explicitly reserved ones through MAP_HUGETLB first, then transparent
+// huge pages through madvise(MADV_HUGEPAGE) on a 2 MB aligned mapping, then plain pages.
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+enum GridMemoryKind {
+    // operator new, for grids too small to bother with
+    GRID_MEMORY_HEAP,
+    // reserved huge pages, mmap(MAP_HUGETLB)
+    GRID_MEMORY_HUGETLB,
+    // transparent huge pages, madvise(MADV_HUGEPAGE)
+    GRID_MEMORY_TRANSPARENT,
+    // a mapping the kernel wouldn't back with huge pages
+    GRID_MEMORY_PAGES
+};
+const int GRID_MEMORY_KINDS = 4;
+
+// bytes currently allocated of each kind, for reporting
+inline std::atomic<size_t> *gridMemoryBytes()
+{
+    static std::atomic<size_t> bytes[GRID_MEMORY_KINDS];
+    return bytes;
+}
+
+// huge pages can be turned off, e.g. to benchmark against plain pages. big grids are
+// still mapped directly, just with huge pages explicitly refused
+inline bool &gridHugePagesEnabled()
+{
+    static bool enabled = true;
+    return enabled;
+}
+
+// frees grid memory the way it was allocated
+struct GridMemoryDeleter {
+    size_t bytes;
+    GridMemoryKind kind;
+
+    GridMemoryDeleter() : bytes(0), kind(GRID_MEMORY_HEAP) {}
+    GridMemoryDeleter(size_t bytes, GridMemoryKind kind) : bytes(bytes), kind(kind) {}
+
+    void operator()(void *memory) const
+    {
+        if (memory == NULL) {
+            return;
+        }
+        gridMemoryBytes()[kind] -= bytes;
+#if defined(__linux__)
+        if (kind != GRID_MEMORY_HEAP) {
+            munmap(memory, bytes);
+            return;
+        }
+#endif
+        ::operator delete(memory);
+    }
+};
+
+// whether madvise(MADV_HUGEPAGE) can get anywhere, it still succeeds when the system
+// has transparent huge pages switched off
+inline bool transparentHugePagesAvailable()
+{
+#if defined(__linux__)
+    FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (file == NULL) {
+        return false;
+    }
+    char setting[128] = { 0 };
+    size_t length = fread(setting, 1, sizeof(setting) - 1, file);
+    fclose(file);
+    setting[length] = 0;
+    return std::string(setting).find("[never]") == std::string::npos;
+#else
+    return false;
+#endif
+}
+
+// at least `bytes` of memory for grid cells, and what backs it. a caller that needs
+// page-sized control over placement, e.g. to split rows between NUMA nodes, passes
+// hugePages = false. mapped memory isn't touched here, its pages are placed on the node
+// of whichever thread writes them first
+inline void *allocateGridMemory(size_t bytes, GridMemoryDeleter &deleter, bool hugePages = true)
+{
+#if defined(__linux__)
+    if (bytes >= HUGE_PAGE_SIZE) {
+        size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        hugePages = hugePages && gridHugePagesEnabled();
+
+#ifdef MAP_HUGETLB
+        void *memory = hugePages
+            ? mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)
+            : MAP_FAILED;
+        if (memory != MAP_FAILED) {
+            deleter = GridMemoryDeleter(rounded, GRID_MEMORY_HUGETLB);
+            gridMemoryBytes()[GRID_MEMORY_HUGETLB] += rounded;
+            return memory;
+        }
+#endif
+
+        // over-allocate so a 2 MB aligned range fits, then give back the ends. transparent
+        // huge pages only cover aligned 2 MB ranges
+        size_t mapped = rounded + HUGE_PAGE_SIZE;
+        void *region = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region != MAP_FAILED) {
+            char *start = (char *)region;
+            char *aligned = (char *)(((size_t)start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+            if (aligned > start) {
+                munmap(start, aligned - start);
+            }
+            size_t tail = (start + mapped) - (aligned + rounded);
+            if (tail > 0) {
+                munmap(aligned + rounded, tail);
+            }
+
+            GridMemoryKind kind = GRID_MEMORY_PAGES;
+#ifdef MADV_HUGEPAGE
+            if (!hugePages) {
+                // keep the kernel from using them anyway when it's set to always
+                madvise(aligned, rounded, MADV_NOHUGEPAGE);
+            } else if (madvise(aligned, rounded, MADV_HUGEPAGE) == 0 && transparentHugePagesAvailable()) {
+                kind = GRID_MEMORY_TRANSPARENT;
+            }
+#endif
+            deleter = GridMemoryDeleter(rounded, kind);
+            gridMemoryBytes()[kind] += rounded;
+            return aligned;
+        }
+    }
+#endif
+
+    deleter = GridMemoryDeleter(bytes, GRID_MEMORY_HEAP);
+    gridMemoryBytes()[GRID_MEMORY_HEAP] += bytes;
+    return ::operator new(bytes);
+}
+
+// one line summary of what the grids live in, e.g. for the log at startup
+inline std::string gridMemoryReport()
+{
+    static const char *const names[GRID_MEMORY_KINDS] = {
+        "heap", "MAP_HUGETLB huge pages", "transparent huge pages", "normal pages (no huge pages)"
+    };
+
+    std::string report = "grid memory:";
+    bool first = true;
+    for (int kind = 0; kind < GRID_MEMORY_KINDS; kind++) {
+        size_t bytes = gridMemoryBytes()[kind];
+        if (bytes == 0) {
+            continue;
+        }
+        char part[96];
+        snprintf(part, sizeof(part), "%s %.1f MB in %s", first ? "" : ",", bytes / (1024.0 * 1024.0), names[kind]);
+        report += part;
+        first = false;
+    }
+    return report;
+}
+#endif
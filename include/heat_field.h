@@ -0,0 +1,213 @@
+#ifndef HEAT_FIELD_H
+#define HEAT_FIELD_H
+
+#include <../include/materials.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SANDY_HEAT_SSE2 1
+#endif
+
+// temperatures of a world, a second layer next to the materials. heat spreads by a
+// stencil pass of its own that runs every heatInterval() ticks instead of by anything in
+// the movement kernels, so worlds without anything hot in them don't pay for it at all:
+// the field is only allocated once something hot is drawn, and the pass stops once the
+// temperatures stop changing. heat spreads through every material alike
+
+// degrees celsius
+const short AMBIENT_TEMPERATURE = 20;
+const short HEATER_TEMPERATURE = 1500;
+
+// columns the stencil sweeps up a whole world at a time, so the three rows it reads stay
+// in cache however wide the world is
+const unsigned int HEAT_BLOCK_COLUMNS = 1024;
+
+// ticks between heat passes
+inline unsigned int &heatInterval()
+{
+    static unsigned int ticks = 2;
+    return ticks;
+}
+
+// what a material turns into at a temperature, see MaterialDefinition
+inline int heatedMaterial(int particleType, short temperature)
+{
+    const MaterialDefinition &material = materialDefinitions[particleType];
+    if (temperature >= material.meltsAt) {
+        return material.meltsInto;
+    }
+    if (temperature < material.coolsBelow) {
+        return material.coolsInto;
+    }
+    return particleType;
+}
+
+class HeatField
+{
+public:
+    HeatField(unsigned int width, unsigned int height)
+        : w(width), h(height), stride(width + 2), active(false), warm(false)
+    {
+    }
+
+    // a material was drawn. heaters and anything that wouldn't last at ambient temperature
+    // need the pass, the first one allocates the field
+    void noteDrawn(int particleType)
+    {
+        if (particleType != HEATER && heatedMaterial(particleType, AMBIENT_TEMPERATURE) == particleType) {
+            return;
+        }
+        if (current.empty()) {
+            current.assign((size_t)stride * (h + 2), AMBIENT_TEMPERATURE);
+            next = current;
+            held.assign(current.size(), 0);
+            for (size_t c = 0; c < insulated.size(); c++) {
+                held[insulated[c]] = AMBIENT_TEMPERATURE;
+            }
+        }
+        active = true;
+    }
+    // ------------------------------------------------------------------------
+    // materials moved. on a field that isn't ambient everywhere they may have moved
+    // somewhere hot enough to change them
+    void noteMoved()
+    {
+        if (warm) {
+            active = true;
+        }
+    }
+    // ------------------------------------------------------------------------
+    // cell (x, y) is held at ambient temperature like the border round the world, e.g. the
+    // walls between the worlds of a batch sheet, so no heat gets across it
+    void insulate(unsigned int x, unsigned int y)
+    {
+        size_t i = (size_t)(y + 1) * stride + x + 1;
+        insulated.push_back(i);
+        if (!held.empty()) {
+            held[i] = AMBIENT_TEMPERATURE;
+        }
+    }
+    // ------------------------------------------------------------------------
+    // a pass is due on this tick
+    bool due(int step) const
+    {
+        return active && step % heatInterval() == 0;
+    }
+    // ------------------------------------------------------------------------
+    // the temperatures are as they'll stay until something moves or is drawn
+    bool settled() const
+    {
+        return !active;
+    }
+    // ------------------------------------------------------------------------
+    // temperatures of row y, width() of them. the field has to be allocated
+    short *row(unsigned int y)
+    {
+        return &current[(size_t)(y + 1) * stride + 1];
+    }
+    // ------------------------------------------------------------------------
+    // the temperatures the cells of row y are held at, 0 for the cells the stencil sets.
+    // a heater is held at HEATER_TEMPERATURE (see applyHeat), so a field around heaters
+    // stops changing once the heat they give off has spread as far as it goes. the field
+    // has to be allocated
+    short *heldRow(unsigned int y)
+    {
+        return &held[(size_t)(y + 1) * stride + 1];
+    }
+    // ------------------------------------------------------------------------
+    // one step of the stencil: every cell gets (4 * itself + its 4 neighbours) / 8 but the
+    // held ones, which keep their temperature. the border around the world stays ambient
+    // and soaks up heat. returns whether any temperature changed
+    bool diffuse()
+    {
+        bool changed = false;
+        bool warmer = false;
+        for (unsigned int first = 0; first < w; first += HEAT_BLOCK_COLUMNS) {
+            unsigned int last = std::min(first + HEAT_BLOCK_COLUMNS, w);
+            for (unsigned int y = 0; y < h; y++) {
+                diffuseSpan(y, first, last, changed, warmer);
+            }
+        }
+        current.swap(next);
+        warm = warmer;
+        return changed;
+    }
+    // ------------------------------------------------------------------------
+    // after a pass: with nothing changed there's nothing to do until the materials move
+    void finishPass(bool changed)
+    {
+        active = changed;
+    }
+
+private:
+    unsigned int w;
+    unsigned int h;
+    // a row and the ambient cell on either side of it
+    unsigned int stride;
+    // a pass would change something
+    bool active;
+    // somewhere isn't at ambient temperature
+    bool warm;
+    // with an ambient row below and above the world, empty until something hot is drawn
+    std::vector<short> current;
+    std::vector<short> next;
+    // see heldRow, laid out like current
+    std::vector<short> held;
+    // indices into current of the cells insulate() was called for, held at ambient
+    std::vector<size_t> insulated;
+
+    void diffuseSpan(unsigned int y, unsigned int first, unsigned int last, bool &changed, bool &warmer)
+    {
+        size_t start = (size_t)(y + 1) * stride + 1 + first;
+        const short *center = &current[start];
+        const short *up = center + stride;
+        const short *down = center - stride;
+        // the neighbours on either side, so x - 1 needn't wrap round at column 0
+        const short *left = center - 1;
+        const short *right = center + 1;
+        short *out = &next[start];
+        const short *hold = &held[start];
+        unsigned int count = last - first;
+        unsigned int x = 0;
+
+#if defined(SANDY_HEAT_SSE2)
+        // 8 cells at a time, the sum of 8 temperatures of at most HEATER_TEMPERATURE fits 16 bits
+        const __m128i ambient = _mm_set1_epi16(AMBIENT_TEMPERATURE);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i differs = _mm_setzero_si128();
+        __m128i notAmbient = _mm_setzero_si128();
+        for (; x + 8 <= count; x += 8) {
+            __m128i self = _mm_loadu_si128((const __m128i *)(center + x));
+            __m128i sides = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(left + x)),
+                                          _mm_loadu_si128((const __m128i *)(right + x)));
+            __m128i vertical = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(up + x)),
+                                             _mm_loadu_si128((const __m128i *)(down + x)));
+            __m128i sum = _mm_add_epi16(_mm_slli_epi16(self, 2), _mm_add_epi16(sides, vertical));
+            __m128i temperature = _mm_srai_epi16(sum, 3);
+            // the held cells' temperatures instead where they're not 0
+            __m128i hot = _mm_loadu_si128((const __m128i *)(hold + x));
+            temperature = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(hot, zero), temperature), hot);
+            _mm_storeu_si128((__m128i *)(out + x), temperature);
+            differs = _mm_or_si128(differs, _mm_xor_si128(temperature, self));
+            notAmbient = _mm_or_si128(notAmbient, _mm_xor_si128(temperature, ambient));
+        }
+        changed = changed || _mm_movemask_epi8(_mm_cmpeq_epi16(differs, zero)) != 0xffff;
+        warmer = warmer || _mm_movemask_epi8(_mm_cmpeq_epi16(notAmbient, zero)) != 0xffff;
+#endif
+        // rounding down rather than to nearest, so a lone degree above ambient still
+        // fades out instead of staying put forever
+        for (; x < count; x++) {
+            short temperature = (short)((4 * center[x] + left[x] + right[x] + up[x] + down[x]) >> 3);
+            if (hold[x] != 0) {
+                temperature = hold[x];
+            }
+            out[x] = temperature;
+            changed = changed || temperature != center[x];
+            warmer = warmer || temperature != AMBIENT_TEMPERATURE;
+        }
+    }
+};
+#endif
@@ -0,0 +1,293 @@
+#ifndef INTENT_SIMULATION_H
+#define INTENT_SIMULATION_H
+
+#include <../include/numa_topology.h>
+#include <../include/parallel_simulation.h>
+#include <../include/simulation.h>
+#include <../include/worker_pool.h>
+
+#include <algorithm>
+#include <memory>
+
+// an engine whose tick only ever reads the current grid, so what it does doesn't depend
+// on the order the cells are visited in. the serial kernels look at the next grid while
+// they write it (a particle sees what already moved below it in the same sweep), which
+// ties them to one bottom to top sweep. here a tick is two passes instead:
+//  - intents: every particle that wants to move writes where to as one byte, looking at
+//    the current grid only, and
+//  - resolve: every cell works out what ends up in it. of the intents aimed at a cell the
+//    one first in a fixed order wins (see claimant()), the losers stay where they are.
+// each pass reads grids the other one wrote, so either splits into bands of rows any
+// which way and the worlds come out the same on any number of workers. they are not the
+// reference's worlds though: the rules come from the same tables, but a particle can't
+// move into a cell that's only being left in the same tick, so a falling column opens up
+// gaps before it packs together again
+
+// an intent byte: 0 to stay put, otherwise the column offset of the move + 2 in the low
+// 2 bits, the rows it goes down in the next 4 and what happens to a particle already in
+// the target cell in the top 2
+const unsigned char INTENT_STAY = 0;
+const unsigned char INTENT_SWAP = 64;
+const unsigned char INTENT_REACT = 128;
+
+constexpr unsigned char moveIntent(int columns, unsigned int rowsDown, unsigned char withTarget = 0)
+{
+    return (unsigned char)((columns + 2) | rowsDown << 2 | withTarget);
+}
+
+// the intent of each ParticleAction but a fall, whose rows depend on the fall speed
+constexpr unsigned char ACTION_INTENTS[] = {
+    INTENT_STAY,
+    INTENT_STAY,
+    INTENT_STAY,
+    moveIntent(0, 1, INTENT_REACT),
+    moveIntent(0, 1, INTENT_SWAP),
+    moveIntent(-1, 1, INTENT_SWAP),
+    moveIntent(1, 1, INTENT_SWAP),
+    moveIntent(-1, 1),
+    moveIntent(1, 1),
+    moveIntent(-1, 0),
+    moveIntent(1, 0)
+};
+
+inline int intentColumns(unsigned char intent)
+{
+    return (intent & 3) - 2;
+}
+
+inline unsigned int intentRows(unsigned char intent)
+{
+    return (intent >> 2) & 15;
+}
+
+// the grid simulation ticked in intent and resolve passes on pinned workers
+template <typename GridT>
+class IntentGridSimulation : public GridSimulation<GridT>
+{
+public:
+    IntentGridSimulation(unsigned int width, unsigned int height, unsigned int workers = parallelWorkerCount())
+        : GridSimulation<GridT>(width, height), pool(cpusForWorkers(workers)),
+          intents(width, height), speeds(width, height), nextVelocity(width, height), nextVariation(width, height)
+    {
+    }
+
+protected:
+    void tick()
+    {
+        pool.run([this](unsigned int worker) {
+            unsigned int first, last;
+            band(worker, first, last);
+            for (unsigned int y = first; y < last; y++) {
+                writeIntents(y);
+            }
+        });
+        pool.run([this](unsigned int worker) {
+            unsigned int first, last;
+            band(worker, first, last);
+            for (unsigned int y = first; y < last; y++) {
+                resolveRow(y);
+            }
+            finishStreaming();
+        });
+        this->cells.velocity.swap(nextVelocity);
+        this->cells.colorVariation.swap(nextVariation);
+    }
+
+private:
+    typedef typename GridT::template Rebind<unsigned char> ByteGrid;
+    typedef typename GridT::template Rebind<signed char> VariationGrid;
+
+    WorkerPool pool;
+    // what each particle of the current grid wants to do this tick
+    ByteGrid intents;
+    // fall speed a particle has once its intent is carried out
+    ByteGrid speeds;
+    // attributes of the next grid, swapped in at the end of the tick
+    ByteGrid nextVelocity;
+    VariationGrid nextVariation;
+
+    // the rows a worker takes in both passes
+    void band(unsigned int worker, unsigned int &first, unsigned int &last) const
+    {
+        unsigned int height = this->cells.height();
+        first = (unsigned int)((unsigned long long)height * worker / pool.size());
+        last = (unsigned int)((unsigned long long)height * (worker + 1) / pool.size());
+    }
+    // ------------------------------------------------------------------------
+    void writeIntents(unsigned int y)
+    {
+        const GridT &materials = this->cells.material;
+        int i = materials.index(0, y);
+        for (unsigned int x = 0; x < materials.width(); x++, i = materials.right(i)) {
+            speeds[i] = 0;
+            intents[i] = particleIntent(i);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // what processParticle would do, with every neighbour read from the current grid and
+    // every move turned into an intent
+    unsigned char particleIntent(int i)
+    {
+        const GridT &materials = this->cells.material;
+        int particleType = materials[i];
+        if (materialRules().state(particleType) == STATIC) {
+            return INTENT_STAY;
+        }
+
+        ParticleAction action = neighborhoodRules().action(particleType, materials[materials.down(i)],
+                                                           materials[materials.downLeft(i)], materials[materials.downRight(i)],
+                                                           materials[materials.left(i)], materials[materials.right(i)],
+                                                           this->motion.flowing);
+        if (action == ACTION_FALL) {
+            return fallIntent(i);
+        }
+        if (action == ACTION_WAIT && !this->motion.waiting.load(std::memory_order_relaxed)) {
+            this->motion.waiting.store(true, std::memory_order_relaxed);
+        }
+        return ACTION_INTENTS[action];
+    }
+    // ------------------------------------------------------------------------
+    // fall as far as the fall speed allows into cells that are empty now
+    unsigned char fallIntent(int i)
+    {
+        const GridT &materials = this->cells.material;
+        unsigned int speed = std::min(this->cells.velocity[i] + 1u, MAX_FALL_SPEED);
+        unsigned int rows = 1;
+        int landing = materials.down(i);
+        while (rows < speed && materials[materials.down(landing)] == EMPTY) {
+            landing = materials.down(landing);
+            rows++;
+        }
+        speeds[i] = (unsigned char)speed;
+        return moveIntent(0, rows);
+    }
+    // ------------------------------------------------------------------------
+    // where an intent takes the particle in cell i
+    int target(int i, unsigned char intent) const
+    {
+        const GridT &materials = this->cells.material;
+        for (unsigned int rows = intentRows(intent); rows > 0; rows--) {
+            i = materials.down(i);
+        }
+        int columns = intentColumns(intent);
+        return columns > 0 ? materials.right(i) : columns < 0 ? materials.left(i) : i;
+    }
+    // ------------------------------------------------------------------------
+    // the cell whose intent wins cell t on row y, -1 if none does. falls from straight
+    // above come first, nearest first, then the diagonals, then sideways moves. which
+    // side goes first alternates from tick to tick so neither drifts ahead. a particle
+    // can only be swapped or reacted with while it stays put
+    int claimant(int t, unsigned int y) const
+    {
+        const GridT &materials = this->cells.material;
+        if (materials[t] != EMPTY && intents[t] != INTENT_STAY) {
+            return -1;
+        }
+
+        int source = t;
+        for (unsigned int rows = 1; rows <= MAX_FALL_SPEED && y + rows < materials.height(); rows++) {
+            source = materials.up(source);
+            unsigned char intent = intents[source];
+            if (intent != INTENT_STAY && intentColumns(intent) == 0 && intentRows(intent) == rows) {
+                return source;
+            }
+            // nothing further up can fall past a particle
+            if (materials[source] != EMPTY) {
+                break;
+            }
+        }
+
+        // then the diagonals and then sideways moves. the border's intents stay 0, so the
+        // cells next to the edges need no checks
+        int above = materials.up(t);
+        int candidates[4] = { materials.left(above), materials.right(above), materials.left(t), materials.right(t) };
+        int columns[4] = { 1, -1, 1, -1 };
+        unsigned int rows[4] = { 1, 1, 0, 0 };
+        int firstSide = this->step % 2;
+        for (int c = 0; c < 4; c++) {
+            // from the left first on even ticks, from the right on odd ones
+            int k = c ^ firstSide;
+            unsigned char intent = intents[candidates[k]];
+            if (intent != INTENT_STAY && intentColumns(intent) == columns[k] && intentRows(intent) == rows[k]) {
+                return candidates[k];
+            }
+        }
+        return -1;
+    }
+    // ------------------------------------------------------------------------
+    // the next grid's cells of row y, its attributes and its colors
+    void resolveRow(unsigned int y)
+    {
+        const MaterialRules &rules = materialRules();
+        CellStore<GridT> &cells = this->cells;
+        const GridT &materials = cells.material;
+        GridT &next = cells.nextMaterial;
+        int step = this->step;
+        bool rowChanged = false;
+
+        int i = materials.index(0, y);
+        for (unsigned int x = 0; x < materials.width(); x++, i = materials.right(i)) {
+            int particleType = materials[i];
+            int becomes = particleType;
+            unsigned char velocity = 0;
+            signed char variation = cells.colorVariation[i];
+
+            unsigned char intent = intents[i];
+            int source = -1;
+            if (intent != INTENT_STAY) {
+                int to = target(i, intent);
+                if (claimant(to, y - intentRows(intent)) == i) {
+                    // the particle leaves, whatever was in its target takes its place
+                    int targetType = materials[to];
+                    if (intent & INTENT_REACT) {
+                        becomes = rules.becomes(particleType, targetType);
+                        variation = spawnColorVariation(x, y, step);
+                    } else {
+                        becomes = targetType;
+                        variation = cells.colorVariation[to];
+                    }
+                }
+                // otherwise it's blocked and stays, nothing can move into it either
+            } else {
+                source = claimant(i, y);
+            }
+
+            if (source >= 0) {
+                int sourceType = materials[source];
+                if (intents[source] & INTENT_REACT) {
+                    becomes = rules.neighborBecomes(sourceType, particleType);
+                    variation = spawnColorVariation(x, y, step);
+                } else {
+                    becomes = sourceType;
+                    velocity = particleType == EMPTY ? speeds[source] : 0;
+                    variation = cells.colorVariation[source];
+                }
+            }
+
+            next[i] = (unsigned char)becomes;
+            nextVelocity[i] = velocity;
+            nextVariation[i] = variation;
+            if (becomes != particleType) {
+                this->motion.changedTiles.mark(x, y);
+                rowChanged = true;
+            }
+        }
+
+        if (rowChanged && !this->motion.changed.load(std::memory_order_relaxed)) {
+            this->motion.changed.store(true, std::memory_order_relaxed);
+        }
+        renderRow(next, nextVariation, y, this->colors.data() + (size_t)y * cells.width());
+    }
+};
+
+// the intent engine for a canvas size, tiled when it's very wide like the default one
+inline std::unique_ptr<Simulation> makeIntentSimulation(unsigned int width, unsigned int height,
+                                                        unsigned int workers = parallelWorkerCount())
+{
+    if (width >= TILED_LAYOUT_MIN_WIDTH) {
+        return std::unique_ptr<Simulation>(
+            new IntentGridSimulation<Grid<unsigned char, DYNAMIC_EXTENT, DYNAMIC_EXTENT, TiledLayout> >(width, height, workers));
+    }
+    return std::unique_ptr<Simulation>(new IntentGridSimulation<Grid<unsigned char> >(width, height, workers));
+}
+#endif
@@ -0,0 +1,127 @@
+#ifndef MATERIAL_COUNTS_H
+#define MATERIAL_COUNTS_H
+
+#include <../include/material_pyramid.h>
+#include <../include/materials.h>
+
+#include <algorithm>
+#include <vector>
+
+// how many cells of each material there are in every tile of a world, the tiles being
+// those of ChangedTiles. the histograms of the tiles whose cells changed are recounted
+// after each tick the way the pyramid is kept, and a query over a rectangle adds up the
+// histograms of the tiles it covers whole, only the cells along its ragged edges are
+// looked at one by one. "how much water is in here" over a big area costs a few hundred
+// additions rather than a scan
+
+class MaterialCounts
+{
+public:
+    MaterialCounts(unsigned int width, unsigned int height)
+        : w(width), h(height),
+          tilesWide((width + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE),
+          tilesHigh((height + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE),
+          histograms((size_t)tilesWide * tilesHigh * MATERIAL_COUNT)
+    {
+    }
+
+    // every tile from scratch. materialAt(x, y) gives the material of a world cell
+    template <typename Source>
+    void rebuild(const Source &materialAt)
+    {
+        for (unsigned int ty = 0; ty < tilesHigh; ty++) {
+            for (unsigned int tx = 0; tx < tilesWide; tx++) {
+                recount(materialAt, tx, ty);
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // recount the tiles that changed, see ChangedTiles::takeMarked
+    template <typename Source>
+    void update(const Source &materialAt, const std::vector<TilePosition> &changed)
+    {
+        for (size_t t = 0; t < changed.size(); t++) {
+            recount(materialAt, changed[t].x, changed[t].y);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // add the cells of each material in the width x height rectangle whose bottom left
+    // cell is (left, bottom) to counts[MATERIAL_COUNT]. the rectangle is clipped to the
+    // world
+    template <typename Source>
+    void count(const Source &materialAt, unsigned int left, unsigned int bottom, unsigned int width, unsigned int height,
+               unsigned int *counts) const
+    {
+        left = std::min(left, w);
+        bottom = std::min(bottom, h);
+        unsigned int right = left + std::min(width, w - left);
+        unsigned int top = bottom + std::min(height, h - bottom);
+
+        // the tiles inside the rectangle, the last tile of a world counts as whole where
+        // it sticks out over the world's edge
+        unsigned int firstTileX = (left + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+        unsigned int firstTileY = (bottom + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+        unsigned int lastTileX = right == w ? tilesWide : right / PYRAMID_TILE_SIZE;
+        unsigned int lastTileY = top == h ? tilesHigh : top / PYRAMID_TILE_SIZE;
+        if (firstTileX >= lastTileX || firstTileY >= lastTileY) {
+            // not a single whole tile, nothing to do but look at every cell
+            countCells(materialAt, left, bottom, right, top, counts);
+            return;
+        }
+
+        for (unsigned int ty = firstTileY; ty < lastTileY; ty++) {
+            for (unsigned int tx = firstTileX; tx < lastTileX; tx++) {
+                const unsigned short *histogram = &histograms[((size_t)ty * tilesWide + tx) * MATERIAL_COUNT];
+                for (int m = 0; m < MATERIAL_COUNT; m++) {
+                    counts[m] += histogram[m];
+                }
+            }
+        }
+
+        // the edges around the whole tiles: the full width below and above them, the
+        // sides next to them
+        unsigned int innerLeft = firstTileX * PYRAMID_TILE_SIZE;
+        unsigned int innerBottom = firstTileY * PYRAMID_TILE_SIZE;
+        unsigned int innerRight = std::min(lastTileX * PYRAMID_TILE_SIZE, w);
+        unsigned int innerTop = std::min(lastTileY * PYRAMID_TILE_SIZE, h);
+        countCells(materialAt, left, bottom, right, innerBottom, counts);
+        countCells(materialAt, left, innerTop, right, top, counts);
+        countCells(materialAt, left, innerBottom, innerLeft, innerTop, counts);
+        countCells(materialAt, innerRight, innerBottom, right, innerTop, counts);
+    }
+
+private:
+    unsigned int w;
+    unsigned int h;
+    unsigned int tilesWide;
+    unsigned int tilesHigh;
+    // MATERIAL_COUNT counts per tile, a tile's cells fit 16 bits
+    std::vector<unsigned short> histograms;
+
+    template <typename Source>
+    void recount(const Source &materialAt, unsigned int tx, unsigned int ty)
+    {
+        unsigned int counts[MATERIAL_COUNT] = {};
+        unsigned int left = tx * PYRAMID_TILE_SIZE;
+        unsigned int bottom = ty * PYRAMID_TILE_SIZE;
+        countCells(materialAt, left, bottom, std::min(left + PYRAMID_TILE_SIZE, w), std::min(bottom + PYRAMID_TILE_SIZE, h),
+                   counts);
+        unsigned short *histogram = &histograms[((size_t)ty * tilesWide + tx) * MATERIAL_COUNT];
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            histogram[m] = (unsigned short)counts[m];
+        }
+    }
+    // ------------------------------------------------------------------------
+    // columns left..right-1 of rows bottom..top-1
+    template <typename Source>
+    static void countCells(const Source &materialAt, unsigned int left, unsigned int bottom, unsigned int right,
+                           unsigned int top, unsigned int *counts)
+    {
+        for (unsigned int y = bottom; y < top; y++) {
+            for (unsigned int x = left; x < right; x++) {
+                counts[materialAt(x, y)]++;
+            }
+        }
+    }
+};
+#endif
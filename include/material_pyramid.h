@@ -0,0 +1,268 @@
+#ifndef MATERIAL_PYRAMID_H
+#define MATERIAL_PYRAMID_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// zoomed out views of a world too big to show cell for cell. level l of the pyramid has
+// a cell for every 2^l x 2^l block of the world holding the material that dominates the
+// block's 4 cells on level l - 1; level 0 is the world itself and isn't stored. the
+// levels are kept up to date from the tiles whose cells changed, so a tick in which a
+// few particles moved costs a few tiles rather than the whole world, and a viewer
+// uploads and samples just the one level that fits its window
+
+// tiles whose changes are tracked are 2^PYRAMID_TILE_LEVELS cells on a side
+const unsigned int PYRAMID_TILE_LEVELS = 5;
+const unsigned int PYRAMID_TILE_SIZE = 1u << PYRAMID_TILE_LEVELS;
+
+// a tile of ChangedTiles, in tiles from the bottom left
+struct TilePosition {
+    unsigned int x;
+    unsigned int y;
+};
+
+// which tiles of a world had a cell's material set since the views kept up from them
+// (the pyramid, MaterialCounts) last looked. the marks are atomic because strips of a
+// parallel sweep set them from several threads
+class ChangedTiles
+{
+public:
+    ChangedTiles(unsigned int width, unsigned int height)
+        : tilesWide((width + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE),
+          tilesHigh((height + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE),
+          marks(new std::atomic<unsigned char>[(size_t)tilesWide * tilesHigh])
+    {
+        clear();
+    }
+
+    void mark(unsigned int x, unsigned int y)
+    {
+        std::atomic<unsigned char> &tile = marks[(size_t)(y >> PYRAMID_TILE_LEVELS) * tilesWide + (x >> PYRAMID_TILE_LEVELS)];
+        // most changes land in a tile that's already marked, don't dirty its line again
+        if (!tile.load(std::memory_order_relaxed)) {
+            tile.store(1, std::memory_order_relaxed);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // whether tile (tx, ty) changed, clearing its mark
+    bool take(unsigned int tx, unsigned int ty)
+    {
+        std::atomic<unsigned char> &tile = marks[(size_t)ty * tilesWide + tx];
+        if (!tile.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        tile.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    // every marked tile, clearing the marks
+    void takeMarked(std::vector<TilePosition> &tiles)
+    {
+        tiles.clear();
+        for (unsigned int ty = 0; ty < tilesHigh; ty++) {
+            for (unsigned int tx = 0; tx < tilesWide; tx++) {
+                if (take(tx, ty)) {
+                    TilePosition tile = { tx, ty };
+                    tiles.push_back(tile);
+                }
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        for (size_t t = 0; t < (size_t)tilesWide * tilesHigh; t++) {
+            marks[t].store(0, std::memory_order_relaxed);
+        }
+    }
+    // ------------------------------------------------------------------------
+    unsigned int width() const { return tilesWide; }
+    unsigned int height() const { return tilesHigh; }
+
+private:
+    unsigned int tilesWide;
+    unsigned int tilesHigh;
+    std::unique_ptr<std::atomic<unsigned char>[]> marks;
+};
+
+// the material of most of up to 4 cells, ties go to the higher material so particles
+// don't vanish into empty space when zoomed out
+inline unsigned char dominantMaterial(const unsigned char *values, int count)
+{
+    unsigned char best = values[0];
+    int bestVotes = 0;
+    for (int a = 0; a < count; a++) {
+        int votes = 0;
+        for (int b = 0; b < count; b++) {
+            votes += values[b] == values[a];
+        }
+        if (votes > bestVotes || (votes == bestVotes && values[a] > best)) {
+            best = values[a];
+            bestVotes = votes;
+        }
+    }
+    return best;
+}
+
+class MaterialPyramid
+{
+public:
+    MaterialPyramid(unsigned int width, unsigned int height)
+    {
+        unsigned int w = width, h = height;
+        levelSizes.push_back(LevelSize(w, h));
+        while (w > 1 || h > 1) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            levelSizes.push_back(LevelSize(w, h));
+        }
+        cells.resize(levelSizes.size());
+        queued.resize(levelSizes.size());
+        changedRows.resize(levelSizes.size(), RowRange(1, 0));
+        for (size_t l = 1; l < levelSizes.size(); l++) {
+            cells[l].resize((size_t)levelSizes[l].width * levelSizes[l].height);
+        }
+    }
+
+    // levels including level 0, the world itself
+    unsigned int levels() const { return (unsigned int)levelSizes.size(); }
+    unsigned int levelWidth(unsigned int level) const { return levelSizes[level].width; }
+    unsigned int levelHeight(unsigned int level) const { return levelSizes[level].height; }
+
+    // the cells of a level from 1 up, levelWidth() per row from the bottom
+    const unsigned char *level(unsigned int level) const
+    {
+        return cells[level].data();
+    }
+    // ------------------------------------------------------------------------
+    // every level from scratch. materialAt(x, y) gives the material of a world cell
+    template <typename Source>
+    void rebuild(const Source &materialAt)
+    {
+        for (unsigned int l = 1; l < levels(); l++) {
+            for (unsigned int y = 0; y < levelHeight(l); y++) {
+                for (unsigned int x = 0; x < levelWidth(l); x++) {
+                    recompute(materialAt, l, x, y);
+                }
+            }
+            changedRows[l] = RowRange(0, levelHeight(l) - 1);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // bring the levels up to date with the tiles that changed, see ChangedTiles::takeMarked
+    template <typename Source>
+    void update(const Source &materialAt, const std::vector<TilePosition> &changed)
+    {
+        // the tile levels are redone inside each changed tile
+        unsigned int tileLevels = std::min(PYRAMID_TILE_LEVELS, levels() - 1);
+        dirty.clear();
+        for (size_t t = 0; t < changed.size(); t++) {
+            unsigned int tx = changed[t].x;
+            unsigned int ty = changed[t].y;
+            for (unsigned int l = 1; l <= tileLevels; l++) {
+                unsigned int span = PYRAMID_TILE_SIZE >> l;
+                unsigned int lastX = std::min((tx + 1) * span, levelWidth(l));
+                unsigned int lastY = std::min((ty + 1) * span, levelHeight(l));
+                for (unsigned int y = ty * span; y < lastY; y++) {
+                    for (unsigned int x = tx * span; x < lastX; x++) {
+                        recompute(materialAt, l, x, y);
+                    }
+                }
+                includeRows(l, ty * span, lastY - 1);
+            }
+            dirty.push_back(Position(tx, ty));
+        }
+
+        // above the tiles a changed cell changes one parent per level
+        for (unsigned int l = tileLevels + 1; l < levels(); l++) {
+            std::vector<unsigned char> &marks = queued[l];
+            marks.resize((size_t)levelWidth(l) * levelHeight(l));
+            parents.clear();
+            for (size_t d = 0; d < dirty.size(); d++) {
+                Position parent(dirty[d].x / 2, dirty[d].y / 2);
+                unsigned char &mark = marks[(size_t)parent.y * levelWidth(l) + parent.x];
+                if (!mark) {
+                    mark = 1;
+                    parents.push_back(parent);
+                }
+            }
+            for (size_t p = 0; p < parents.size(); p++) {
+                recompute(materialAt, l, parents[p].x, parents[p].y);
+                includeRows(l, parents[p].y, parents[p].y);
+                marks[(size_t)parents[p].y * levelWidth(l) + parents[p].x] = 0;
+            }
+            dirty.swap(parents);
+        }
+    }
+    // ------------------------------------------------------------------------
+    // the rows of a level that changed since the last call for that level. false if
+    // none did
+    bool takeChangedRows(unsigned int level, unsigned int &first, unsigned int &last)
+    {
+        RowRange &rows = changedRows[level];
+        if (rows.first > rows.last) {
+            return false;
+        }
+        first = rows.first;
+        last = rows.last;
+        rows = RowRange(1, 0);
+        return true;
+    }
+
+private:
+    struct LevelSize {
+        unsigned int width;
+        unsigned int height;
+        LevelSize(unsigned int width, unsigned int height) : width(width), height(height) {}
+    };
+    struct Position {
+        unsigned int x;
+        unsigned int y;
+        Position(unsigned int x, unsigned int y) : x(x), y(y) {}
+    };
+    // empty while first > last
+    struct RowRange {
+        unsigned int first;
+        unsigned int last;
+        RowRange(unsigned int first, unsigned int last) : first(first), last(last) {}
+    };
+
+    std::vector<LevelSize> levelSizes;
+    std::vector<std::vector<unsigned char> > cells;
+    std::vector<RowRange> changedRows;
+    // cells of a level already queued for recomputing, kept all clear between updates
+    std::vector<std::vector<unsigned char> > queued;
+    // changed cells of the level below and their parents, reused between updates
+    std::vector<Position> dirty;
+    std::vector<Position> parents;
+
+    template <typename Source>
+    void recompute(const Source &materialAt, unsigned int l, unsigned int x, unsigned int y)
+    {
+        unsigned char values[4] = { 0, 0, 0, 0 };
+        int count = 0;
+        unsigned int childWidth = levelWidth(l - 1);
+        unsigned int lastX = std::min(2 * x + 2, childWidth);
+        unsigned int lastY = std::min(2 * y + 2, levelHeight(l - 1));
+        for (unsigned int cy = 2 * y; cy < lastY; cy++) {
+            for (unsigned int cx = 2 * x; cx < lastX; cx++) {
+                values[count++] = l == 1 ? (unsigned char)materialAt(cx, cy) : cells[l - 1][(size_t)cy * childWidth + cx];
+            }
+        }
+        cells[l][(size_t)y * levelWidth(l) + x] = dominantMaterial(values, count);
+    }
+    // ------------------------------------------------------------------------
+    void includeRows(unsigned int l, unsigned int first, unsigned int last)
+    {
+        RowRange &rows = changedRows[l];
+        if (rows.first > rows.last) {
+            rows = RowRange(first, last);
+        } else {
+            rows = RowRange(std::min(rows.first, first), std::max(rows.last, last));
+        }
+    }
+};
+#endif
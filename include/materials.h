@@ -0,0 +1,181 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum particleTypes{
+    EMPTY,
+    WALL,
+    SAND,
+    WATER,
+    STEAM,
+    GLASS,
+    HEATER,
+    OIL,
+    ACID
+};
+
+const int MATERIAL_COUNT = 9;
+
+// cold attributes a material carries along when it moves. the movement kernels only
+// touch an attribute grid for materials that have its flag set
+const unsigned char CARRIES_VELOCITY = 1;
+const unsigned char CARRIES_COLOR_VARIATION = 2;
+
+// how a material moves. static ones are copied over as they are by every tick, powders
+// fall and pile up into slopes, liquids fall and spread out sideways
+enum MaterialState {
+    STATIC,
+    POWDER,
+    LIQUID
+};
+
+// display color of each material, 0-255 per channel
+struct MaterialColor {
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+};
+
+// a heat transition that never happens
+const short NO_TRANSITION = 32767;
+
+// everything the engines know about a material. adding one is a line here (and one in
+// materialReactions if it reacts with anything), the kernels go by the tables that
+// MaterialRules compiles from these
+struct MaterialDefinition {
+    const char *name;
+    MaterialColor color;
+    MaterialState state;
+    // kg/m^3, a falling particle sinks through liquids lighter than itself
+    short density;
+    // ticks between sideways steps of a liquid on level ground, 1 for water
+    unsigned char flowTicks;
+    unsigned char attributes;
+    // at or above meltsAt degrees the material turns into meltsInto, below coolsBelow
+    // into coolsInto (see heat_field.h)
+    short meltsAt;
+    unsigned char meltsInto;
+    short coolsBelow;
+    unsigned char coolsInto;
+};
+
+constexpr MaterialDefinition materialDefinitions[MATERIAL_COUNT] = {
+    { "empty", { 0, 0, 0 }, STATIC, 0, 0, 0, NO_TRANSITION, EMPTY, -NO_TRANSITION, EMPTY },
+    { "wall", { 117, 116, 103 }, STATIC, 2400, 0, 0, NO_TRANSITION, WALL, -NO_TRANSITION, WALL },
+    { "sand", { 244, 228, 101 }, POWDER, 1600, 0, CARRIES_VELOCITY | CARRIES_COLOR_VARIATION,
+      1200, GLASS, -NO_TRANSITION, SAND },
+    { "water", { 17, 65, 166 }, LIQUID, 1000, 1, CARRIES_VELOCITY | CARRIES_COLOR_VARIATION,
+      100, STEAM, -NO_TRANSITION, WATER },
+    // steam doesn't move yet, it hangs where the water boiled until it condenses
+    { "steam", { 196, 206, 214 }, STATIC, 1, 0, CARRIES_COLOR_VARIATION, NO_TRANSITION, STEAM, 100, WATER },
+    { "glass", { 164, 214, 222 }, STATIC, 2500, 0, 0, NO_TRANSITION, GLASS, -NO_TRANSITION, GLASS },
+    { "heater", { 214, 72, 28 }, STATIC, 7800, 0, 0, NO_TRANSITION, HEATER, -NO_TRANSITION, HEATER },
+    { "oil", { 92, 64, 24 }, LIQUID, 800, 3, CARRIES_VELOCITY | CARRIES_COLOR_VARIATION,
+      NO_TRANSITION, OIL, -NO_TRANSITION, OIL },
+    { "acid", { 120, 214, 48 }, LIQUID, 1200, 1, CARRIES_VELOCITY | CARRIES_COLOR_VARIATION,
+      NO_TRANSITION, ACID, -NO_TRANSITION, ACID }
+};
+
+// what two materials turn into when a particle of the first lands on one of the second.
+// reactions work both ways round, the products swap along with the pair
+struct MaterialReaction {
+    unsigned char material;
+    unsigned char neighbor;
+    unsigned char materialBecomes;
+    unsigned char neighborBecomes;
+};
+
+constexpr MaterialReaction materialReactions[] = {
+    // acid eats sand and is used up doing it
+    { ACID, SAND, EMPTY, EMPTY },
+    // and is watered down to nothing in water
+    { ACID, WATER, WATER, WATER }
+};
+
+// the definitions compiled into dense tables the kernels index by material, or by the
+// pair of a particle and the neighbour it's looking at, instead of branching per material.
+// it's all constexpr so the tables are built by the compiler and a lookup for a material
+// the kernel already knows folds away
+class MaterialRules
+{
+public:
+    // interaction flags of a pair
+    static const unsigned char SINKS_THROUGH = 1;
+    static const unsigned char REACTS = 2;
+
+    constexpr MaterialRules()
+    {
+        for (int a = 0; a < MATERIAL_COUNT; a++) {
+            const MaterialDefinition &material = materialDefinitions[a];
+            states[a] = (unsigned char)material.state;
+            flows[a] = material.flowTicks;
+            attributeFlags[a] = material.attributes;
+            for (int b = 0; b < MATERIAL_COUNT; b++) {
+                const MaterialDefinition &neighbor = materialDefinitions[b];
+                bool sinks = material.state != STATIC && neighbor.state == LIQUID && material.density > neighbor.density;
+                interactions[a][b] = sinks ? SINKS_THROUGH : 0;
+                products[a][b][0] = (unsigned char)a;
+                products[a][b][1] = (unsigned char)b;
+            }
+        }
+        for (size_t r = 0; r < sizeof(materialReactions) / sizeof(materialReactions[0]); r++) {
+            const MaterialReaction &reaction = materialReactions[r];
+            addReaction(reaction.material, reaction.neighbor, reaction.materialBecomes, reaction.neighborBecomes);
+            addReaction(reaction.neighbor, reaction.material, reaction.neighborBecomes, reaction.materialBecomes);
+        }
+    }
+
+    constexpr MaterialState state(int particleType) const { return (MaterialState)states[particleType]; }
+    constexpr unsigned char attributes(int particleType) const { return attributeFlags[particleType]; }
+    // a liquid steps sideways on ticks that are a multiple of this
+    constexpr unsigned int flowTicks(int particleType) const { return flows[particleType]; }
+    // a particle of the first material landing on the second sinks into it
+    constexpr bool sinksThrough(int particleType, int neighborType) const
+    {
+        return interactions[particleType][neighborType] & SINKS_THROUGH;
+    }
+    constexpr bool reacts(int particleType, int neighborType) const
+    {
+        return interactions[particleType][neighborType] & REACTS;
+    }
+    // what the particle and its neighbour turn into when they react
+    constexpr int becomes(int particleType, int neighborType) const { return products[particleType][neighborType][0]; }
+    constexpr int neighborBecomes(int particleType, int neighborType) const { return products[particleType][neighborType][1]; }
+
+private:
+    unsigned char states[MATERIAL_COUNT] = {};
+    unsigned char flows[MATERIAL_COUNT] = {};
+    unsigned char attributeFlags[MATERIAL_COUNT] = {};
+    unsigned char interactions[MATERIAL_COUNT][MATERIAL_COUNT] = {};
+    unsigned char products[MATERIAL_COUNT][MATERIAL_COUNT][2] = {};
+
+    constexpr void addReaction(int material, int neighbor, int materialBecomes, int neighborBecomes)
+    {
+        interactions[material][neighbor] |= REACTS;
+        products[material][neighbor][0] = (unsigned char)materialBecomes;
+        products[material][neighbor][1] = (unsigned char)neighborBecomes;
+    }
+};
+
+constexpr MaterialRules MATERIAL_RULES = MaterialRules();
+
+inline const MaterialRules &materialRules()
+{
+    return MATERIAL_RULES;
+}
+
+// particles get a shade within this many steps of their material's color when spawned
+const int COLOR_VARIATION_RANGE = 12;
+
+// shade for a particle spawned at (x, y) on a given tick. a hash rather than rand() so
+// runs are repeatable
+inline signed char spawnColorVariation(unsigned int x, unsigned int y, unsigned int step) {
+    uint32_t hash = x * 73856093u ^ y * 19349663u ^ step * 83492791u;
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    return (signed char)((int)(hash % (2 * COLOR_VARIATION_RANGE + 1)) - COLOR_VARIATION_RANGE);
+}
+#endif
@@ -0,0 +1,184 @@
+#ifndef NEIGHBORHOOD_RULES_H
+#define NEIGHBORHOOD_RULES_H
+
+#include <../include/materials.h>
+
+// what a powder or liquid particle does this tick, decided by one table lookup instead of
+// a chain of ifs on its neighbours. in a mixed scene the chain's branches go one way for
+// sand and another for water next to it and the branch predictor keeps guessing wrong;
+// here each neighbour is looked up by the pair (particle, neighbour) in a small class
+// table, the classes are packed into a pattern of NEIGHBORHOOD_PATTERN_BITS bits and the
+// pattern indexes a table of actions. the tables are built at compile time from
+// MaterialRules by the same chain of ifs the kernels used to run per cell
+
+enum ParticleAction {
+    // stay put, settled until a neighbour changes
+    ACTION_STAY,
+    // stay put for now, a thick liquid waiting for its next sideways step
+    ACTION_WAIT,
+    ACTION_FALL,
+    // react with the particle below, see materialReactions
+    ACTION_REACT,
+    // trade places with the lighter liquid below, down-left or down-right
+    ACTION_SINK,
+    ACTION_SINK_DOWN_LEFT,
+    ACTION_SINK_DOWN_RIGHT,
+    // move into the empty cell down-left, down-right, left or right
+    ACTION_MOVE_DOWN_LEFT,
+    ACTION_MOVE_DOWN_RIGHT,
+    ACTION_MOVE_LEFT,
+    ACTION_MOVE_RIGHT
+};
+
+// how the cell below looks to a particle
+const unsigned char BELOW_BLOCKS = 0;
+const unsigned char BELOW_EMPTY = 1;
+const unsigned char BELOW_SINKS = 2;
+const unsigned char BELOW_REACTS = 3;
+// blocks, but a powder slides off it
+const unsigned char BELOW_POWDER = 4;
+
+// how a cell diagonally below looks to a particle, nothing reacts diagonally
+const unsigned char DIAGONAL_BLOCKS = 0;
+const unsigned char DIAGONAL_EMPTY = 1;
+const unsigned char DIAGONAL_SINKS = 2;
+
+// the pattern: bit 0 liquid rather than powder, bits 1-3 the class below, bits 4-5 and
+// 6-7 the classes down-left and down-right, bits 8 and 9 whether left and right are
+// empty, bit 10 whether the particle's liquid steps sideways this tick
+const int NEIGHBORHOOD_PATTERN_BITS = 11;
+const int NEIGHBORHOOD_PATTERNS = 1 << NEIGHBORHOOD_PATTERN_BITS;
+
+// materials whose liquids step sideways on a tick, a bit per material
+inline unsigned int flowingMaterials(int step)
+{
+    unsigned int flowing = 0;
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        unsigned int ticks = materialRules().flowTicks(m);
+        if (ticks > 0 && step % ticks == 0) {
+            flowing |= 1u << m;
+        }
+    }
+    return flowing;
+}
+
+class NeighborhoodRules
+{
+public:
+    constexpr NeighborhoodRules()
+    {
+        const MaterialRules &rules = MATERIAL_RULES;
+        for (int a = 0; a < MATERIAL_COUNT; a++) {
+            liquids[a] = rules.state(a) == LIQUID;
+            for (int b = 0; b < MATERIAL_COUNT; b++) {
+                unsigned char below = BELOW_BLOCKS;
+                unsigned char diagonal = DIAGONAL_BLOCKS;
+                if (b == EMPTY) {
+                    below = BELOW_EMPTY;
+                    diagonal = DIAGONAL_EMPTY;
+                } else if (rules.reacts(a, b)) {
+                    below = BELOW_REACTS;
+                } else if (rules.sinksThrough(a, b)) {
+                    below = BELOW_SINKS;
+                } else if (rules.state(b) == POWDER) {
+                    below = BELOW_POWDER;
+                }
+                if (b != EMPTY && rules.sinksThrough(a, b)) {
+                    diagonal = DIAGONAL_SINKS;
+                }
+                belowClasses[a][b] = below;
+                diagonalClasses[a][b] = diagonal;
+            }
+        }
+        for (int pattern = 0; pattern < NEIGHBORHOOD_PATTERNS; pattern++) {
+            actions[pattern] = (unsigned char)decide(pattern);
+        }
+    }
+
+    // the pattern of a particle of a powder or liquid among its neighbours' materials.
+    // flowing is flowingMaterials() of the tick
+    constexpr int pattern(int particleType, int downType, int downLeftType, int downRightType, int leftType, int rightType,
+                          unsigned int flowing) const
+    {
+        return liquids[particleType] | belowClasses[particleType][downType] << 1 |
+               diagonalClasses[particleType][downLeftType] << 4 | diagonalClasses[particleType][downRightType] << 6 |
+               (leftType == EMPTY) << 8 | (rightType == EMPTY) << 9 | ((flowing >> particleType) & 1) << 10;
+    }
+    // ------------------------------------------------------------------------
+    constexpr ParticleAction action(int particleType, int downType, int downLeftType, int downRightType, int leftType,
+                                    int rightType, unsigned int flowing) const
+    {
+        return (ParticleAction)actions[pattern(particleType, downType, downLeftType, downRightType, leftType, rightType, flowing)];
+    }
+
+private:
+    unsigned char liquids[MATERIAL_COUNT] = {};
+    unsigned char belowClasses[MATERIAL_COUNT][MATERIAL_COUNT] = {};
+    unsigned char diagonalClasses[MATERIAL_COUNT][MATERIAL_COUNT] = {};
+    unsigned char actions[NEIGHBORHOOD_PATTERNS] = {};
+
+    // the rules for one pattern: powders fall, react, sink through lighter liquids and
+    // slide off other powder diagonally; liquids fall, react, sink, run off diagonally or
+    // spread sideways on the ticks they flow
+    static constexpr ParticleAction decide(int pattern)
+    {
+        bool liquid = pattern & 1;
+        int below = (pattern >> 1) & 7;
+        int downLeft = (pattern >> 4) & 3;
+        int downRight = (pattern >> 6) & 3;
+        bool leftEmpty = (pattern >> 8) & 1;
+        bool rightEmpty = (pattern >> 9) & 1;
+        bool flows = (pattern >> 10) & 1;
+
+        if (below == BELOW_EMPTY) {
+            return ACTION_FALL;
+        }
+        if (below == BELOW_REACTS) {
+            return ACTION_REACT;
+        }
+        if (below == BELOW_SINKS) {
+            return ACTION_SINK;
+        }
+
+        if (!liquid) {
+            if (below != BELOW_POWDER) {
+                return ACTION_STAY;
+            }
+            if (downRight == DIAGONAL_EMPTY) {
+                return ACTION_MOVE_DOWN_RIGHT;
+            }
+            if (downLeft == DIAGONAL_EMPTY) {
+                return ACTION_MOVE_DOWN_LEFT;
+            }
+            if (downLeft == DIAGONAL_SINKS) {
+                return ACTION_SINK_DOWN_LEFT;
+            }
+            if (downRight == DIAGONAL_SINKS) {
+                return ACTION_SINK_DOWN_RIGHT;
+            }
+            return ACTION_STAY;
+        }
+
+        if (downRight == DIAGONAL_EMPTY) {
+            return ACTION_MOVE_DOWN_RIGHT;
+        }
+        if (downLeft == DIAGONAL_EMPTY) {
+            return ACTION_MOVE_DOWN_LEFT;
+        }
+        if (!rightEmpty && !leftEmpty) {
+            return ACTION_STAY;
+        }
+        if (!flows) {
+            return ACTION_WAIT;
+        }
+        return rightEmpty ? ACTION_MOVE_RIGHT : ACTION_MOVE_LEFT;
+    }
+};
+
+constexpr NeighborhoodRules NEIGHBORHOOD_RULES = NeighborhoodRules();
+
+inline const NeighborhoodRules &neighborhoodRules()
+{
+    return NEIGHBORHOOD_RULES;
+}
+#endif
@@ -0,0 +1,175 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// which CPUs sit on which NUMA node, read from sysfs so there's no libnuma dependency.
+// only CPUs this process is allowed to run on are listed. anything that can't be read
+// (not Linux, no sysfs) comes out as a single node with every hardware thread on it
+
+struct NumaTopology {
+    // CPU numbers of each node, nodes in ascending order
+    std::vector<std::vector<int> > nodeCpus;
+
+    // every CPU, grouped by node, so consecutive entries share a node wherever possible
+    std::vector<int> cpusByNode() const
+    {
+        std::vector<int> cpus;
+        for (size_t node = 0; node < nodeCpus.size(); node++) {
+            cpus.insert(cpus.end(), nodeCpus[node].begin(), nodeCpus[node].end());
+        }
+        return cpus;
+    }
+    // ------------------------------------------------------------------------
+    // node a CPU belongs to, -1 if it isn't listed
+    int nodeOf(int cpu) const
+    {
+        for (size_t node = 0; node < nodeCpus.size(); node++) {
+            for (size_t c = 0; c < nodeCpus[node].size(); c++) {
+                if (nodeCpus[node][c] == cpu) {
+                    return (int)node;
+                }
+            }
+        }
+        return -1;
+    }
+};
+
+// CPU numbers in a sysfs list like "0-3,8-11"
+inline std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    const char *p = list.c_str();
+    while (*p != 0) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back((int)cpu);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    return cpus;
+}
+
+inline NumaTopology readNumaTopology()
+{
+    NumaTopology topology;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    // node directories can be sparse, e.g. node0 and node2 on a machine with one pulled
+    std::vector<int> nodes;
+    DIR *directory = opendir("/sys/devices/system/node");
+    if (directory != NULL) {
+        while (struct dirent *entry = readdir(directory)) {
+            int node;
+            char rest;
+            if (sscanf(entry->d_name, "node%d%c", &node, &rest) == 1) {
+                nodes.push_back(node);
+            }
+        }
+        closedir(directory);
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    for (size_t n = 0; n < nodes.size(); n++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[n]);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        char list[4096] = { 0 };
+        size_t length = fread(list, 1, sizeof(list) - 1, file);
+        fclose(file);
+        list[length] = 0;
+
+        std::vector<int> cpus;
+        std::vector<int> listed = parseCpuList(list);
+        for (size_t c = 0; c < listed.size(); c++) {
+            if (!haveAffinity || (listed[c] < CPU_SETSIZE && CPU_ISSET(listed[c], &allowed))) {
+                cpus.push_back(listed[c]);
+            }
+        }
+        // memory-only nodes have no CPUs to run on
+        if (!cpus.empty()) {
+            topology.nodeCpus.push_back(cpus);
+        }
+    }
+#endif
+
+    if (topology.nodeCpus.empty()) {
+        unsigned int threads = std::thread::hardware_concurrency();
+        std::vector<int> cpus;
+        for (unsigned int cpu = 0; cpu < (threads > 0 ? threads : 1); cpu++) {
+            cpus.push_back((int)cpu);
+        }
+        topology.nodeCpus.push_back(cpus);
+    }
+    return topology;
+}
+
+// the machine's topology, read once
+inline const NumaTopology &numaTopology()
+{
+    static const NumaTopology topology = readNumaTopology();
+    return topology;
+}
+
+// a CPU for each of a number of workers (0 for one per available CPU), handed out node
+// by node so neighbouring workers share a node. more workers than CPUs wrap around
+inline std::vector<int> cpusForWorkers(unsigned int workers)
+{
+    std::vector<int> cpus = numaTopology().cpusByNode();
+    if (workers == 0) {
+        workers = (unsigned int)cpus.size();
+    }
+    std::vector<int> assigned;
+    for (unsigned int worker = 0; worker < workers; worker++) {
+        assigned.push_back(cpus[worker % cpus.size()]);
+    }
+    return assigned;
+}
+
+// keep the calling thread on one CPU so the memory it first touched stays local to it.
+// false if the platform can't or the CPU isn't available
+inline bool pinCurrentThread(int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+#endif
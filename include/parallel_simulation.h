@@ -0,0 +1,207 @@
+#ifndef PARALLEL_SIMULATION_H
+#define PARALLEL_SIMULATION_H
+
+#include <../include/numa_topology.h>
+#include <../include/simulation.h>
+#include <../include/worker_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+// multithreaded sweep that produces exactly the worlds the single-threaded one does.
+// the canvas is cut into vertical strips of columns and every strip is swept bottom to
+// top by the one worker that owns it, on every tick. a cell only ever reads and writes
+// its own column and the ones right next to it, so a strip only has to stay in the
+// sweep's row-major order with the strips beside it:
+//  - row y of strip s waits until strip s - 1 has finished row y, which the serial
+//    sweep would have done first, and
+//  - until strip s + 1 has finished row y - 1, which it reads and moves particles into.
+// neighbouring strips end up taking turns row by row while strips two apart run at the
+// same time, so each worker owns two neighbouring strips and always has one to sweep.
+// strips are at least MIN_STRIP_WIDTH wide, which keeps strips two apart from ever
+// touching the same cells, sleep bytes or occupancy words.
+//
+// workers are pinned to CPUs handed out node by node, so the strips of one socket form
+// one band of columns, and the grids are created unfilled and first written by the
+// worker that owns each strip (see GridFirstTouch). the kernel puts those pages on the
+// owner's node, and since strips never change hands the sweep of a strip reads local
+// memory every tick. only the columns where two sockets' bands meet cross the
+// interconnect. on more than one node the grids stay on 4 KB pages, a 2 MB page holds
+// whole rows and would land on one node
+
+// strips two apart must not share a column, or cells next to one
+const unsigned int MIN_STRIP_WIDTH = 4;
+// strip edges snap to a multiple of this many columns when the canvas is wide enough,
+// a cache line of material bytes and a whole number of tiles
+const unsigned int STRIP_ALIGNMENT = 64;
+// neighbouring strips take turns, two per worker keeps every worker busy
+const unsigned int STRIPS_PER_WORKER = 2;
+// spins on a strip's progress before yielding the CPU to whoever it's waiting for
+const unsigned int STRIP_WAIT_SPINS = 256;
+
+// workers of the parallel engine, 0 for one per CPU this process may run on
+inline unsigned int &parallelWorkerCount()
+{
+    static unsigned int workers = 0;
+    return workers;
+}
+
+// rows of a strip swept so far this tick, -1 until its columns of the next grid are
+// cleared. a cache line each, so polling one strip doesn't slow down the next
+struct alignas(64) StripProgress {
+    std::atomic<int> rows;
+};
+
+// the strips, their pinned workers and their progress. kept apart from the simulation
+// so it exists before the grids are created and can first-touch them
+class StripSchedule : public GridFirstTouch
+{
+public:
+    StripSchedule(unsigned int width, unsigned int workers)
+        : pool(cpusForWorkers(workers)), nodes(1)
+    {
+        unsigned int strips = std::max(1u, std::min(pool.size() * STRIPS_PER_WORKER, width / MIN_STRIP_WIDTH));
+        bool aligned = width / strips >= STRIP_ALIGNMENT;
+        for (unsigned int s = 0; s < strips; s++) {
+            unsigned int edge = (unsigned int)((unsigned long long)s * width / strips);
+            stripEdges.push_back(aligned ? edge / STRIP_ALIGNMENT * STRIP_ALIGNMENT : edge);
+        }
+        stripEdges.push_back(width);
+        progress.reset(new StripProgress[strips]);
+
+        std::set<int> usedNodes;
+        for (unsigned int worker = 0; worker < pool.size() && firstStrip(worker) < stripCount(); worker++) {
+            usedNodes.insert(numaTopology().nodeOf(pool.cpu(worker)));
+        }
+        nodes = (unsigned int)usedNodes.size();
+    }
+
+    void touchColumns(unsigned int paddedWidth, const std::function<void(unsigned int, unsigned int)> &fill) const
+    {
+        pool.run([this, paddedWidth, &fill](unsigned int worker) {
+            for (unsigned int s = firstStrip(worker); s < lastStrip(worker); s++) {
+                // the border columns go with the outer strips
+                unsigned int first = s == 0 ? 0 : stripEdges[s] + 1;
+                unsigned int last = s + 1 == stripCount() ? paddedWidth : stripEdges[s + 1] + 1;
+                fill(first, last);
+            }
+        });
+    }
+    // ------------------------------------------------------------------------
+    bool spansNodes() const
+    {
+        return nodes > 1;
+    }
+
+protected:
+    mutable WorkerPool pool;
+    // stripCount() + 1 column edges, strip s is columns stripEdges[s]..stripEdges[s + 1] - 1
+    std::vector<unsigned int> stripEdges;
+    std::unique_ptr<StripProgress[]> progress;
+    // NUMA nodes the workers with strips are spread over
+    unsigned int nodes;
+
+    unsigned int stripCount() const { return (unsigned int)stripEdges.size() - 1; }
+    unsigned int firstStrip(unsigned int worker) const { return std::min(worker * STRIPS_PER_WORKER, stripCount()); }
+    unsigned int lastStrip(unsigned int worker) const { return std::min((worker + 1) * STRIPS_PER_WORKER, stripCount()); }
+
+    // block until a strip has swept at least this many rows. strips off either end of
+    // the canvas count as done
+    void waitForRows(int strip, int rows) const
+    {
+        if (strip < 0 || strip >= (int)stripCount()) {
+            return;
+        }
+        for (unsigned int spins = 0; progress[strip].rows.load(std::memory_order_acquire) < rows; spins++) {
+            if (spins < STRIP_WAIT_SPINS) {
+                spinPause();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+// the grid simulation with its sweep spread over pinned workers
+template <typename GridT>
+class ParallelGridSimulation : private StripSchedule, public GridSimulation<GridT>
+{
+public:
+    ParallelGridSimulation(unsigned int width, unsigned int height, unsigned int workers = parallelWorkerCount())
+        : StripSchedule(width, workers), GridSimulation<GridT>(width, height, this)
+    {
+    }
+
+protected:
+    void tick()
+    {
+        for (unsigned int s = 0; s < stripCount(); s++) {
+            progress[s].rows.store(-1, std::memory_order_relaxed);
+        }
+        pool.run([this](unsigned int worker) {
+            sweepStrips(worker);
+        });
+
+        // the top rows only settle once every strip is done
+        CellStore<GridT> &cells = this->cells;
+        unsigned int height = cells.height();
+        for (unsigned int y = height > MAX_FALL_SPEED ? height - MAX_FALL_SPEED : 0; y < height; y++) {
+            renderRow(cells.nextMaterial, cells.colorVariation, y, this->colors.data() + (size_t)y * cells.width());
+        }
+        finishStreaming();
+    }
+
+private:
+    // updateCanvas for the strips of one worker, row by row in step with the neighbours
+    void sweepStrips(unsigned int worker)
+    {
+        CellStore<GridT> &cells = this->cells;
+        const GridT &currentCanvas = cells.material;
+        GridT &canvasData = cells.nextMaterial;
+        Rgba8 *colors = this->colors.data();
+        unsigned int first = firstStrip(worker);
+        unsigned int last = lastStrip(worker);
+
+        // clear before anyone can move a particle in, see StripProgress
+        for (unsigned int s = first; s < last; s++) {
+            canvasData.fillInterior(EMPTY, stripEdges[s], stripEdges[s + 1]);
+            progress[s].rows.store(0, std::memory_order_release);
+        }
+
+        for (unsigned int y = 0; y < currentCanvas.height(); y++) {
+            for (unsigned int s = first; s < last; s++) {
+                waitForRows((int)s - 1, (int)y + 1);
+                waitForRows((int)s + 1, (int)y);
+
+                int i = currentCanvas.index(stripEdges[s], y);
+                for (unsigned int x = stripEdges[s]; x < stripEdges[s + 1]; x++, i = currentCanvas.right(i)) {
+                    updateCell(i, cells, this->motion, this->step);
+                }
+
+                // both neighbours are past row y - MAX_FALL_SPEED + 1, the last one
+                // that could still move something into it
+                if (y >= MAX_FALL_SPEED) {
+                    unsigned int finishedRow = y - MAX_FALL_SPEED;
+                    renderRowSpan(canvasData, cells.colorVariation, finishedRow, stripEdges[s], stripEdges[s + 1],
+                                  colors + (size_t)finishedRow * currentCanvas.width());
+                }
+                progress[s].rows.store((int)y + 1, std::memory_order_release);
+            }
+        }
+        finishStreaming();
+    }
+};
+
+// the parallel engine for a canvas size, tiled when it's very wide like the default one
+inline std::unique_ptr<Simulation> makeParallelSimulation(unsigned int width, unsigned int height)
+{
+    if (width >= TILED_LAYOUT_MIN_WIDTH) {
+        return std::unique_ptr<Simulation>(new ParallelGridSimulation<Grid<unsigned char, DYNAMIC_EXTENT, DYNAMIC_EXTENT, TiledLayout> >(width, height));
+    }
+    return std::unique_ptr<Simulation>(new ParallelGridSimulation<Grid<unsigned char> >(width, height));
+}
+#endif
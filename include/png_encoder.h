@@ -0,0 +1,285 @@
+#ifndef PNG_ENCODER_H
+#define PNG_ENCODER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// self-contained PNG writer for exporting frames. stb_image only decodes, so this does the
+// other direction: 8-bit RGBA, Sub-filtered rows, deflated with LZ77 and the fixed Huffman
+// codes. that's nowhere near as tight as zlib but sand worlds are long runs of identical
+// pixels, which is exactly what it handles well, and it needs nothing outside the repo
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table()
+    {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+    }
+};
+
+inline uint32_t crc32Update(uint32_t crc, const unsigned char *data, size_t length)
+{
+    // built once on first use, safe to reach from several encoder threads at once
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline uint32_t adler32(const unsigned char *data, size_t length)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (length > 0) {
+        // largest block that can't overflow before the modulo
+        size_t block = length < 5552 ? length : 5552;
+        length -= block;
+        while (block-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// deflate bit stream, least significant bit first
+class DeflateBitWriter
+{
+public:
+    DeflateBitWriter(std::vector<unsigned char> &out) : out(out), bitBuffer(0), bitCount(0) {}
+
+    void writeBits(uint32_t value, int count)
+    {
+        bitBuffer |= value << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            out.push_back((unsigned char)bitBuffer);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+    // ------------------------------------------------------------------------
+    // huffman codes go out most significant bit first
+    void writeCode(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        writeBits(reversed, length);
+    }
+    // ------------------------------------------------------------------------
+    void flush()
+    {
+        if (bitCount > 0) {
+            out.push_back((unsigned char)bitBuffer);
+        }
+        bitBuffer = 0;
+        bitCount = 0;
+    }
+
+private:
+    std::vector<unsigned char> &out;
+    uint32_t bitBuffer;
+    int bitCount;
+};
+
+// literal/length symbol in the fixed huffman code of RFC 1951 3.2.6
+inline void writeFixedSymbol(DeflateBitWriter &bits, int symbol)
+{
+    if (symbol < 144) {
+        bits.writeCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        bits.writeCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        bits.writeCode(symbol - 256, 7);
+    } else {
+        bits.writeCode(0xc0 + symbol - 280, 8);
+    }
+}
+
+inline void writeFixedMatch(DeflateBitWriter &bits, int length, int distance)
+{
+    static const int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const int distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                          257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                          8193, 12289, 16385, 24577 };
+    static const int distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                           7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int lengthCode = 28;
+    while (lengthBase[lengthCode] > length) {
+        lengthCode--;
+    }
+    writeFixedSymbol(bits, 257 + lengthCode);
+    bits.writeBits(length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+    int distanceCode = 29;
+    while (distanceBase[distanceCode] > distance) {
+        distanceCode--;
+    }
+    bits.writeCode(distanceCode, 5);
+    bits.writeBits(distance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+}
+
+// zlib stream (header, one fixed huffman deflate block, adler32) of some bytes
+inline std::vector<unsigned char> zlibCompress(const std::vector<unsigned char> &data)
+{
+    const int WINDOW = 32768;
+    const int MIN_MATCH = 3;
+    const int MAX_MATCH = 258;
+    const int HASH_BITS = 15;
+    const int MAX_CHAIN = 16;
+
+    std::vector<unsigned char> out;
+    out.reserve(data.size() / 4 + 64);
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    DeflateBitWriter bits(out);
+    // final block, fixed huffman codes
+    bits.writeBits(1, 1);
+    bits.writeBits(1, 2);
+
+    // hash chains of earlier positions starting with the same three bytes
+    std::vector<int> head((size_t)1 << HASH_BITS, -1);
+    std::vector<int> previous(WINDOW, -1);
+    const unsigned char *bytes = data.data();
+    int size = (int)data.size();
+
+    int position = 0;
+    while (position < size) {
+        int bestLength = 0;
+        int bestDistance = 0;
+
+        if (position + MIN_MATCH <= size) {
+            uint32_t hash = ((bytes[position] << 16) | (bytes[position + 1] << 8) | bytes[position + 2]) * 2654435761u;
+            hash >>= 32 - HASH_BITS;
+
+            int candidate = head[hash];
+            int maxLength = size - position < MAX_MATCH ? size - position : MAX_MATCH;
+            for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && position - candidate <= WINDOW; chain++) {
+                int length = 0;
+                while (length < maxLength && bytes[candidate + length] == bytes[position + length]) {
+                    length++;
+                }
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = position - candidate;
+                    if (length == maxLength) {
+                        break;
+                    }
+                }
+                candidate = previous[candidate & (WINDOW - 1)];
+            }
+
+            previous[position & (WINDOW - 1)] = head[hash];
+            head[hash] = position;
+        }
+
+        if (bestLength >= MIN_MATCH) {
+            writeFixedMatch(bits, bestLength, bestDistance);
+            // keep the chains up to date through the match, mostly so runs chain onto runs
+            for (int i = 1; i < bestLength && position + i + MIN_MATCH <= size; i++) {
+                int p = position + i;
+                uint32_t hash = ((bytes[p] << 16) | (bytes[p + 1] << 8) | bytes[p + 2]) * 2654435761u;
+                hash >>= 32 - HASH_BITS;
+                previous[p & (WINDOW - 1)] = head[hash];
+                head[hash] = p;
+            }
+            position += bestLength;
+        } else {
+            writeFixedSymbol(bits, bytes[position]);
+            position++;
+        }
+    }
+    writeFixedSymbol(bits, 256);
+    bits.flush();
+
+    uint32_t checksum = adler32(data.data(), data.size());
+    out.push_back((unsigned char)(checksum >> 24));
+    out.push_back((unsigned char)(checksum >> 16));
+    out.push_back((unsigned char)(checksum >> 8));
+    out.push_back((unsigned char)checksum);
+    return out;
+}
+
+inline void appendBigEndian(std::vector<unsigned char> &out, uint32_t value)
+{
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+inline void appendPngChunk(std::vector<unsigned char> &png, const char *type, const std::vector<unsigned char> &data)
+{
+    appendBigEndian(png, (uint32_t)data.size());
+    size_t typeStart = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    appendBigEndian(png, crc32Update(0, &png[typeStart], png.size() - typeStart));
+}
+
+// PNG file contents for width x height RGBA8 pixels, rows top to bottom and rowLength
+// pixels apart
+inline std::vector<unsigned char> encodePng(const uint32_t *pixels, unsigned int width, unsigned int height, size_t rowLength)
+{
+    // every row gets the Sub filter, each byte stored as the difference to the same
+    // channel of the pixel on its left, so flat runs of one color become zeros
+    std::vector<unsigned char> filtered;
+    filtered.reserve((size_t)height * (width * 4 + 1));
+    for (unsigned int y = 0; y < height; y++) {
+        const unsigned char *row = (const unsigned char *)(pixels + y * rowLength);
+        filtered.push_back(1);
+        for (unsigned int i = 0; i < width * 4; i++) {
+            filtered.push_back((unsigned char)(row[i] - (i >= 4 ? row[i - 4] : 0)));
+        }
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> png(signature, signature + 8);
+
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.push_back(8);        // bits per channel
+    header.push_back(6);        // RGBA
+    header.push_back(0);        // deflate
+    header.push_back(0);        // adaptive filtering
+    header.push_back(0);        // not interlaced
+    appendPngChunk(png, "IHDR", header);
+    appendPngChunk(png, "IDAT", zlibCompress(filtered));
+    appendPngChunk(png, "IEND", std::vector<unsigned char>());
+    return png;
+}
+
+inline bool writePng(const std::string &path, const uint32_t *pixels, unsigned int width, unsigned int height, size_t rowLength)
+{
+    std::vector<unsigned char> png = encodePng(pixels, width, height, rowLength);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return fclose(file) == 0 && written;
+}
+#endif
@@ -0,0 +1,267 @@
+#ifndef REFERENCE_SIMULATION_H
+#define REFERENCE_SIMULATION_H
+
+#include <../include/simulation.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// the movement rules written as plainly as possible, kept as the oracle every other
+// engine is checked against (see golden.h and differential_fuzzer.h). plain vectors with
+// bounds checks instead of a bordered grid, a walk down the column instead of occupancy
+// bits, no sleeping and no fused rendering. it's slow on purpose: when it disagrees with
+// a fast engine, the fast engine is the one that's wrong.
+// keep the rules in here identical to processParticle and NeighborhoodRules, including
+// their order of preference and which buffer each neighbour is read from
+class ReferenceSimulation : public Simulation
+{
+public:
+    ReferenceSimulation(unsigned int width, unsigned int height)
+        : w(width), h(height), current((size_t)width * height, EMPTY), next((size_t)width * height, EMPTY),
+          fallSpeed((size_t)width * height, 0), colors((size_t)width * height), quiescent(false), drawnSinceUpdate(false),
+          ticks(0), waiting(false)
+    {
+        // the original canvas generator walks x then y but places walls at the linear
+        // position it counted, which fills the first 21 * height cells in row order
+        size_t walls = std::min<size_t>((size_t)std::min(21u, width) * height, current.size());
+        std::fill(current.begin(), current.begin() + walls, (unsigned char)WALL);
+    }
+
+    unsigned int width() const { return w; }
+    unsigned int height() const { return h; }
+
+    void draw(double xpos, double ypos, int particleType)
+    {
+        BrushArea area = brushArea(w, h, xpos, ypos);
+        for (int y = area.bottom; y <= area.top; y++) {
+            for (int x = area.left; x < area.right; x++) {
+                current[cell(x, y)] = (unsigned char)particleType;
+                fallSpeed[cell(x, y)] = 0;
+            }
+        }
+        quiescent = false;
+        drawnSinceUpdate = true;
+    }
+    // ------------------------------------------------------------------------
+    bool update()
+    {
+        // a settled world stays settled, and like the other engines it still counts the
+        // ticks it skips
+        if (quiescent) {
+            ticks++;
+            return false;
+        }
+        std::fill(next.begin(), next.end(), (unsigned char)EMPTY);
+        waiting = false;
+
+        for (int y = 0; y < (int)h; y++) {
+            for (int x = 0; x < (int)w; x++) {
+                int oldParticleType = current[cell(x, y)];
+                int updatedParticleType = next[cell(x, y)];
+
+                // a particle from further down the sweep already moved in
+                if (oldParticleType == EMPTY && updatedParticleType != EMPTY) {
+                    continue;
+                }
+                MaterialState state = materialRules().state(oldParticleType);
+                if (state == POWDER) {
+                    updatePowder(x, y, oldParticleType);
+                } else if (state == LIQUID) {
+                    updateLiquid(x, y, oldParticleType);
+                } else {
+                    next[cell(x, y)] = (unsigned char)oldParticleType;
+                }
+            }
+        }
+        ticks++;
+
+        bool moved = next != current;
+        current.swap(next);
+        quiescent = !moved && !waiting;
+        bool changed = moved || drawnSinceUpdate;
+        drawnSinceUpdate = false;
+        return changed;
+    }
+    // ------------------------------------------------------------------------
+    bool settled() const
+    {
+        return quiescent;
+    }
+    // ------------------------------------------------------------------------
+    // plain material colors, the reference engine doesn't track color variation
+    const Rgba8 *pixels() const
+    {
+        for (size_t i = 0; i < current.size(); i++) {
+            colors[i] = colorTable().color(current[i], 0);
+        }
+        return colors.data();
+    }
+    // ------------------------------------------------------------------------
+    int pixelRowLength() const
+    {
+        return w;
+    }
+    // ------------------------------------------------------------------------
+    int material(unsigned int x, unsigned int y) const
+    {
+        return current[cell(x, y)];
+    }
+    // ------------------------------------------------------------------------
+    uint64_t materialHash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < current.size(); i++) {
+            hash = (hash ^ current[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    unsigned int w;
+    unsigned int h;
+    std::vector<unsigned char> current;
+    std::vector<unsigned char> next;
+    std::vector<unsigned char> fallSpeed;
+    mutable std::vector<Rgba8> colors;
+    bool quiescent;
+    bool drawnSinceUpdate;
+    // ticks run so far, liquids flow sideways on some of them only
+    unsigned int ticks;
+    // a liquid was held back for a later tick in the last one
+    bool waiting;
+
+    size_t cell(int x, int y) const
+    {
+        return (size_t)y * w + x;
+    }
+    // ------------------------------------------------------------------------
+    // anything outside the canvas is a wall
+    int currentAt(int x, int y) const
+    {
+        return x < 0 || y < 0 || x >= (int)w || y >= (int)h ? (int)WALL : current[cell(x, y)];
+    }
+    int nextAt(int x, int y) const
+    {
+        return x < 0 || y < 0 || x >= (int)w || y >= (int)h ? (int)WALL : next[cell(x, y)];
+    }
+    // ------------------------------------------------------------------------
+    void move(int fromX, int fromY, int toX, int toY, int particleType)
+    {
+        next[cell(fromX, fromY)] = EMPTY;
+        next[cell(toX, toY)] = (unsigned char)particleType;
+        fallSpeed[cell(toX, toY)] = fallSpeed[cell(fromX, fromY)];
+    }
+    // ------------------------------------------------------------------------
+    // a particle with empty space below falls one row faster than last tick, up to
+    // MAX_FALL_SPEED rows, stopping on the first cell below that's taken in the next grid
+    void fall(int x, int y, int particleType)
+    {
+        int speed = std::min(fallSpeed[cell(x, y)] + 1, (int)MAX_FALL_SPEED);
+        int landingY = y;
+        while (y - landingY < speed && nextAt(x, landingY - 1) == EMPTY) {
+            landingY--;
+        }
+        move(x, y, x, landingY, particleType);
+        fallSpeed[cell(x, landingY)] = (unsigned char)speed;
+    }
+    // ------------------------------------------------------------------------
+    // a particle and the lighter liquid under it trade places, both stop falling
+    void sink(int x, int y, int particleType, int liquidX, int liquidY, int liquidType)
+    {
+        next[cell(x, y)] = (unsigned char)liquidType;
+        next[cell(liquidX, liquidY)] = (unsigned char)particleType;
+        fallSpeed[cell(x, y)] = 0;
+        fallSpeed[cell(liquidX, liquidY)] = 0;
+    }
+    // ------------------------------------------------------------------------
+    // a particle and what it landed on turn into the products of their reaction
+    void react(int x, int y, int particleType, int neighborX, int neighborY, int neighborType)
+    {
+        const MaterialRules &rules = materialRules();
+        next[cell(x, y)] = (unsigned char)rules.becomes(particleType, neighborType);
+        next[cell(neighborX, neighborY)] = (unsigned char)rules.neighborBecomes(particleType, neighborType);
+        fallSpeed[cell(x, y)] = 0;
+        fallSpeed[cell(neighborX, neighborY)] = 0;
+    }
+    // ------------------------------------------------------------------------
+    void updatePowder(int x, int y, int particleType)
+    {
+        const MaterialRules &rules = materialRules();
+        int down = nextAt(x, y - 1);
+        if (down == EMPTY) {
+            fall(x, y, particleType);
+            return;
+        }
+        if (rules.reacts(particleType, down)) {
+            react(x, y, particleType, x, y - 1, down);
+            return;
+        }
+        fallSpeed[cell(x, y)] = 0;
+
+        if (rules.sinksThrough(particleType, down)) {
+            sink(x, y, particleType, x, y - 1, down);
+        } else if (rules.state(down) == POWDER) {
+            int downLeft = nextAt(x - 1, y - 1);
+            int downRight = nextAt(x + 1, y - 1);
+            if (downRight == EMPTY) {
+                move(x, y, x + 1, y - 1, particleType);
+            } else if (downLeft == EMPTY) {
+                move(x, y, x - 1, y - 1, particleType);
+            } else if (rules.sinksThrough(particleType, downLeft)) {
+                sink(x, y, particleType, x - 1, y - 1, downLeft);
+            } else if (rules.sinksThrough(particleType, downRight)) {
+                sink(x, y, particleType, x + 1, y - 1, downRight);
+            } else {
+                next[cell(x, y)] = (unsigned char)particleType;
+            }
+        } else {
+            next[cell(x, y)] = (unsigned char)particleType;
+        }
+    }
+    // ------------------------------------------------------------------------
+    void updateLiquid(int x, int y, int particleType)
+    {
+        const MaterialRules &rules = materialRules();
+        int down = nextAt(x, y - 1);
+        if (down == EMPTY) {
+            fall(x, y, particleType);
+            return;
+        }
+        if (rules.reacts(particleType, down)) {
+            react(x, y, particleType, x, y - 1, down);
+            return;
+        }
+        fallSpeed[cell(x, y)] = 0;
+
+        if (rules.sinksThrough(particleType, down)) {
+            sink(x, y, particleType, x, y - 1, down);
+            return;
+        }
+        if (nextAt(x + 1, y - 1) == EMPTY) {
+            move(x, y, x + 1, y - 1, particleType);
+            return;
+        }
+        if (nextAt(x - 1, y - 1) == EMPTY) {
+            move(x, y, x - 1, y - 1, particleType);
+            return;
+        }
+
+        // the cell to the right hasn't been swept yet, so it's looked at in the current grid
+        bool rightEmpty = currentAt(x + 1, y) == EMPTY;
+        bool leftEmpty = nextAt(x - 1, y) == EMPTY;
+        if ((rightEmpty || leftEmpty) && ticks % rules.flowTicks(particleType) != 0) {
+            // a thick liquid waits for its next sideways step
+            next[cell(x, y)] = (unsigned char)particleType;
+            waiting = true;
+        } else if (rightEmpty) {
+            move(x, y, x + 1, y, particleType);
+        } else if (leftEmpty) {
+            move(x, y, x - 1, y, particleType);
+        } else {
+            next[cell(x, y)] = (unsigned char)particleType;
+        }
+    }
+};
+#endif
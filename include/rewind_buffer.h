@@ -0,0 +1,209 @@
+#ifndef REWIND_BUFFER_H
+#define REWIND_BUFFER_H
+
+#include <../include/frame_delta.h>
+#include <../include/simulation.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+// the last stretch of a simulation's history, to scrub back through e.g. to see how a
+// jam formed. every recorded frame is kept coded against the one before (see
+// encodeFrameDelta), with a key frame every REWIND_KEY_INTERVAL frames to start
+// decoding from. once the frames take more than the budget, the oldest key frame and
+// the deltas that depend on it are dropped together. a delta only copies and codes the
+// tiles that changed since the frame before (see Simulation::copyChangedMaterials), so
+// on the grid engines recording a tick costs about what the tick changed
+
+// frames between key frames, a seek decodes at most this many deltas
+const unsigned int REWIND_KEY_INTERVAL = 120;
+
+class RewindBuffer
+{
+public:
+    RewindBuffer(unsigned int width, unsigned int height, size_t budgetBytes)
+        : w(width), h(height), cells((size_t)width * height), budget(budgetBytes), stored(0), keyFrames(0), sinceKey(0),
+          firstSequence(0), since(0), previous(cells), current(cells), decoded(cells), decodedSequence(NOT_DECODED)
+    {
+    }
+
+    // keep the simulation's current world as the frame of tick. ticks must not go down
+    void record(Simulation &simulation, unsigned int tick)
+    {
+        since = simulation.copyChangedMaterials(current.data(), since, changedTiles);
+        tileSpans();
+        FrameKind kind = entries.empty() || sinceKey + 1 >= REWIND_KEY_INTERVAL ? FRAME_KEY : FRAME_DELTA;
+        scratch.clear();
+        if (kind == FRAME_KEY) {
+            encodeFrameDelta(NULL, current.data(), cells, scratch);
+        } else {
+            encodeFrameDeltaSpans(previous.data(), current.data(), cells, spans.data(), spans.size(), scratch);
+        }
+
+        Entry entry;
+        entry.tick = tick;
+        entry.kind = kind;
+        // an exact fit, scratch keeps the capacity of the biggest frame so far
+        entry.payload.assign(scratch.begin(), scratch.end());
+        stored += entrySize(entry);
+        entries.push_back(entry);
+        if (kind == FRAME_KEY) {
+            keyFrames++;
+            sinceKey = 0;
+        } else {
+            sinceKey++;
+        }
+        // current holds the whole world, previous catches up where it changed
+        for (size_t s = 0; s < spans.size(); s++) {
+            std::copy(current.begin() + spans[s].begin, current.begin() + spans[s].end, previous.begin() + spans[s].begin);
+        }
+
+        // the newest key frame and what follows it always stay
+        while (stored > budget && keyFrames > 1) {
+            do {
+                stored -= entrySize(entries.front());
+                entries.pop_front();
+                firstSequence++;
+            } while (entries.front().kind != FRAME_KEY);
+            keyFrames--;
+        }
+    }
+    // ------------------------------------------------------------------------
+    bool empty() const
+    {
+        return entries.empty();
+    }
+    // ------------------------------------------------------------------------
+    // oldest and newest tick still kept
+    unsigned int firstTick() const
+    {
+        return entries.front().tick;
+    }
+    // ------------------------------------------------------------------------
+    unsigned int lastTick() const
+    {
+        return entries.back().tick;
+    }
+    // ------------------------------------------------------------------------
+    // the materials of the world at tick, i.e. of the last frame recorded at or before
+    // it, width per row from the bottom. NULL if tick is older than anything kept.
+    // shownTick, if given, gets the tick of that frame. the frames are valid until the
+    // next seek or record
+    const unsigned char *seek(unsigned int tick, unsigned int *shownTick = NULL)
+    {
+        if (entries.empty() || tick < entries.front().tick) {
+            return NULL;
+        }
+        size_t target = std::upper_bound(entries.begin(), entries.end(), tick, [](unsigned int t, const Entry &entry) {
+            return t < entry.tick;
+        }) - entries.begin() - 1;
+        size_t start = target;
+        while (entries[start].kind != FRAME_KEY) {
+            start--;
+        }
+
+        // scrubbing forward only decodes the deltas in between
+        if (decodedSequence != NOT_DECODED && decodedSequence >= firstSequence + start &&
+            decodedSequence <= firstSequence + target) {
+            start = decodedSequence - firstSequence + 1;
+        } else {
+            std::fill(decoded.begin(), decoded.end(), 0);
+        }
+        for (size_t e = start; e <= target; e++) {
+            const std::string &payload = entries[e].payload;
+            decodeFrameDelta((const unsigned char *)payload.data(), payload.size(), decoded.data(), cells);
+        }
+        decodedSequence = firstSequence + target;
+
+        if (shownTick != NULL) {
+            *shownTick = entries[target].tick;
+        }
+        return decoded.data();
+    }
+    // ------------------------------------------------------------------------
+    std::string report() const
+    {
+        char line[160];
+        if (entries.empty()) {
+            snprintf(line, sizeof(line), "rewind: nothing recorded");
+        } else {
+            snprintf(line, sizeof(line), "rewind: ticks %u to %u in %zu frames, %.1f of %.1f MB", firstTick(), lastTick(),
+                     entries.size(), stored / 1e6, budget / 1e6);
+        }
+        return line;
+    }
+
+private:
+    static const uint64_t NOT_DECODED = ~(uint64_t)0;
+
+    struct Entry {
+        unsigned int tick;
+        FrameKind kind;
+        std::string payload;
+    };
+
+    unsigned int w;
+    unsigned int h;
+    size_t cells;
+    size_t budget;
+    // bytes the entries take, payloads and bookkeeping
+    size_t stored;
+    unsigned int keyFrames;
+    // deltas recorded since the last key frame
+    unsigned int sinceKey;
+    std::deque<Entry> entries;
+    // frames recorded before the oldest one still kept, so positions in entries can be
+    // told apart across evictions
+    uint64_t firstSequence;
+    // what the simulation returned for the last frame, see copyChangedMaterials
+    uint64_t since;
+    // the tiles that changed since the last frame and the cells they cover
+    std::vector<TilePosition> changedTiles;
+    std::vector<CellSpan> spans;
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> current;
+    std::string scratch;
+    // the world of the frame the last seek decoded
+    std::vector<unsigned char> decoded;
+    uint64_t decodedSequence;
+
+    static size_t entrySize(const Entry &entry)
+    {
+        return sizeof(Entry) + entry.payload.capacity();
+    }
+    // ------------------------------------------------------------------------
+    // the rows of changedTiles as spans of cells in order, the tiles come row by row of
+    // tiles from the bottom. spans that meet are joined, so a world that changed
+    // everywhere is a single span
+    void tileSpans()
+    {
+        spans.clear();
+        size_t t = 0;
+        while (t < changedTiles.size()) {
+            unsigned int ty = changedTiles[t].y;
+            size_t firstTile = t;
+            while (t < changedTiles.size() && changedTiles[t].y == ty) {
+                t++;
+            }
+            unsigned int bottom = ty * PYRAMID_TILE_SIZE;
+            unsigned int top = std::min(bottom + PYRAMID_TILE_SIZE, h);
+            for (unsigned int y = bottom; y < top; y++) {
+                for (size_t c = firstTile; c < t; c++) {
+                    unsigned int left = changedTiles[c].x * PYRAMID_TILE_SIZE;
+                    unsigned int right = std::min(left + PYRAMID_TILE_SIZE, w);
+                    CellSpan span = { (size_t)y * w + left, (size_t)y * w + right };
+                    if (!spans.empty() && spans.back().end == span.begin) {
+                        spans.back().end = span.end;
+                    } else {
+                        spans.push_back(span);
+                    }
+                }
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,153 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <../include/simulation.h>
+
+// canonical scenes: a canvas size, a tick count and scripted input standing in for
+// someone at the mouse. the input only depends on the tick, so every run of a scene
+// on a correct engine produces the same worlds
+
+// sand poured in on the left third and water on the right, then left to settle
+inline void pourInput(Simulation &simulation, unsigned int tick)
+{
+    // stop pouring after this many ticks and let everything settle
+    const unsigned int POUR_TICKS = 600;
+    if (tick >= POUR_TICKS) {
+        return;
+    }
+
+    double ypos = simulation.height() / 10.0;
+    if (tick % 2 == 0) {
+        simulation.draw(simulation.width() / 3.0, ypos, SAND);
+    } else {
+        simulation.draw(simulation.width() * 2 / 3.0, ypos, WATER);
+    }
+}
+
+// one stream of sand building a pile in the middle
+inline void sandPileInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick < 250) {
+        simulation.draw(simulation.width() / 2.0 - 5, 5, SAND);
+    }
+}
+
+// a pool of water laid down first, then sand dropped into it along a moving cursor
+inline void damInput(Simulation &simulation, unsigned int tick)
+{
+    unsigned int width = simulation.width();
+    if (tick < 30) {
+        simulation.draw((tick * 10) % width, simulation.height() / 2.0, WATER);
+    } else if (tick < 200 && tick % 3 == 0) {
+        simulation.draw((tick * 7) % width, 12, SAND);
+    }
+}
+
+// brush strokes hanging off every edge and corner, erasing now and then, to cover the
+// clipping and the border cells
+inline void edgeInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick >= 160) {
+        return;
+    }
+    double width = simulation.width();
+    double height = simulation.height();
+    const double xs[4] = { -6, width - 4, width + 3, 2 };
+    const double ys[4] = { 3, -2, height - 3, height + 4 };
+
+    int particleType = tick % 7 == 0 ? EMPTY : (tick % 2 == 0 ? SAND : WATER);
+    simulation.draw(xs[tick % 4], ys[(tick / 4) % 4], particleType);
+}
+
+// pouring along a canvas wide enough for the tiled layout
+inline void widePourInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick < 120) {
+        simulation.draw((tick * 97) % simulation.width(), 4, tick % 2 == 0 ? SAND : WATER);
+    }
+}
+
+// sand dropped and left to settle, then oil poured in long after it has. oil only flows
+// sideways every few ticks, so this catches a world whose ticks are counted differently
+// while it sits settled
+inline void lateOilInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick < 20) {
+        simulation.draw(simulation.width() / 2.0 - 5, 5, SAND);
+    } else if (tick >= 140 && tick < 170) {
+        simulation.draw(simulation.width() / 3.0, 5, OIL);
+    }
+}
+
+// a heater against the right edge and nothing else, its heat must stop at the edge
+inline void edgeHeaterInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick == 0) {
+        simulation.draw(simulation.width() - 9.0, simulation.height() - 20.0, HEATER);
+    }
+}
+
+// water poured along the left edge, e.g. right next to the world of edgeHeaterInput
+inline void edgeWaterInput(Simulation &simulation, unsigned int tick)
+{
+    if (tick < 40) {
+        simulation.draw(0, simulation.height() - 20.0, WATER);
+    }
+}
+
+// a heater on the floor with water and sand poured onto it: the water boils into steam
+// that condenses higher up, the sand melts into glass. then a blast throws the top of
+// the pile into the air to land back on it and splash into the water
+inline void heatInput(Simulation &simulation, unsigned int tick)
+{
+    double width = simulation.width();
+    double ypos = simulation.height() - 22.0;
+    if (tick == 0) {
+        simulation.draw(width / 2 - 10, ypos, HEATER);
+        simulation.draw(width / 2, ypos, HEATER);
+    } else if (tick < 120 && tick % 3 == 0) {
+        simulation.draw(width / 2 - 12 + (tick / 3) % 4 * 6, 4, tick % 2 == 0 ? WATER : SAND);
+    } else if (tick == 250) {
+        simulation.blast(width / 2, 20);
+    }
+}
+
+// a pile of sand poured onto a heater, the bottom of it melting into glass. nothing
+// liquid, so once the heat has spread as far as it goes the world settles
+inline void heaterInput(Simulation &simulation, unsigned int tick)
+{
+    double width = simulation.width();
+    if (tick == 0) {
+        simulation.draw(width / 2 - 5, simulation.height() - 22.0, HEATER);
+    } else if (tick < 80) {
+        simulation.draw(width / 2 - 5, 5, SAND);
+    }
+}
+
+struct Scene {
+    const char *name;
+    unsigned int width;
+    unsigned int height;
+    unsigned int ticks;
+    void (*input)(Simulation &simulation, unsigned int tick);
+    // engine the golden hashes are recorded on. scenes using what only the grid engines
+    // have (heat, free particles) are recorded on the default one, and the reference
+    // engine skips them
+    const char *recordedOn;
+    // ticks without input the world gets after the scene to settle in, see settled().
+    // 0 for scenes that needn't, water keeps sloshing about for a long time
+    unsigned int settlesWithin;
+};
+
+const Scene SCENES[] = {
+    { "pour", 200, 150, 700, pourInput, "reference", 0 },
+    { "sand-pile", 128, 128, 400, sandPileInput, "reference", 0 },
+    { "dam", 160, 120, 400, damInput, "reference", 0 },
+    { "edges", 64, 48, 250, edgeInput, "reference", 0 },
+    { "window", 837, 600, 300, pourInput, "reference", 0 },
+    { "wide", 4200, 40, 200, widePourInput, "reference", 0 },
+    { "heat", 96, 72, 400, heatInput, "default", 0 },
+    { "heater", 64, 64, 200, heaterInput, "default", 2000 }
+};
+const int SCENE_COUNT = sizeof(SCENES) / sizeof(SCENES[0]);
+#endif
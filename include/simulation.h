@@ -0,0 +1,1094 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <../include/grid.h>
+#include <../include/cell_store.h>
+#include <../include/color_output.h>
+#include <../include/column_occupancy.h>
+#include <../include/free_particles.h>
+#include <../include/heat_field.h>
+#include <../include/material_counts.h>
+#include <../include/material_pyramid.h>
+#include <../include/materials.h>
+#include <../include/neighborhood_rules.h>
+#include <../include/sleep_bits.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// falling particles speed up by one row per tick until they hit this many rows per tick
+const unsigned int MAX_FALL_SPEED = 8;
+
+// runtime sized canvases at least this wide use the tiled layout, one row of
+// cells there is tens of kilobytes so the row below is rarely still in cache
+const unsigned int TILED_LAYOUT_MIN_WIDTH = 4096;
+
+// memory layout of the compile-time sized canvases. row-major unless the build
+// asks for tiles with -DSANDY_TILED_LAYOUT
+#ifdef SANDY_TILED_LAYOUT
+template <unsigned int W, unsigned int H>
+using CanvasLayout = TiledLayout<W, H>;
+#else
+template <unsigned int W, unsigned int H>
+using CanvasLayout = RowMajorLayout<W, H>;
+#endif
+
+// motion bookkeeping kept alongside the cells
+template <typename GridT>
+struct MotionState {
+    MotionState(const GridT &materials, const GridFirstTouch *firstTouch = NULL)
+        : occupancy(materials.width(), materials.height()),
+          sleep(materials.width(), materials.height(), firstTouch),
+          changedTiles(materials.width(), materials.height()),
+          changed(false), waiting(false), flowing(0)
+    {
+    }
+
+    // which cells are occupied, used to find landing spots without walking the column
+    ColumnOccupancy occupancy;
+    // settled particles that can be skipped until a neighbour changes
+    SleepBits<GridT> sleep;
+    // where materials were set, for keeping a material pyramid up to date
+    ChangedTiles changedTiles;
+    // whether any cell's material was set since this was last cleared. a tick that
+    // changes nothing leaves the world exactly as it was, so every later tick would too.
+    // atomic because strips of a parallel sweep set it from several threads
+    std::atomic<bool> changed;
+    // whether a particle that could have moved was held back for a later tick, so a tick
+    // that changed nothing doesn't mean the world has settled
+    std::atomic<bool> waiting;
+    // flowingMaterials() of the tick being swept
+    unsigned int flowing;
+};
+
+// set a cell's material and keep the column occupancy and sleep bits in sync with it
+template <typename GridT>
+void placeParticle(GridT &materials, int i, int particleType, MotionState<GridT> &motion)
+{
+    materials[i] = (unsigned char)particleType;
+
+    // only the first change writes the flag, after that every thread just reads a
+    // cache line they all share
+    if (!motion.changed.load(std::memory_order_relaxed)) {
+        motion.changed.store(true, std::memory_order_relaxed);
+    }
+    motion.sleep.wake(i);
+    unsigned int x = materials.column(i);
+    unsigned int y = materials.row(i);
+    motion.changedTiles.mark(x, y);
+    if (particleType == EMPTY) {
+        motion.occupancy.clear(x, y);
+    } else {
+        motion.occupancy.set(x, y);
+    }
+}
+
+// copy the cold attributes a material uses from one cell to another. attributes the
+// material doesn't carry are left alone, so their grids aren't touched at all
+template <typename GridT>
+void moveAttributes(CellStore<GridT> &cells, int from, int to, int particleType)
+{
+    unsigned char attributes = materialRules().attributes(particleType);
+    if (attributes & CARRIES_VELOCITY) {
+        cells.velocity[to] = cells.velocity[from];
+    }
+    if (attributes & CARRIES_COLOR_VARIATION) {
+        cells.colorVariation[to] = cells.colorVariation[from];
+    }
+}
+
+// move a particle into an empty cell of the next grid, taking its attributes with it
+template <typename GridT>
+void moveParticle(CellStore<GridT> &cells, int from, int to, int particleType, MotionState<GridT> &motion)
+{
+    placeParticle(cells.nextMaterial, from, EMPTY, motion);
+    placeParticle(cells.nextMaterial, to, particleType, motion);
+    moveAttributes(cells, from, to, particleType);
+}
+
+// exchange two particles, e.g. sand sinking through water
+template <typename GridT>
+void swapParticles(CellStore<GridT> &cells, int a, int typeA, int b, int typeB, MotionState<GridT> &motion)
+{
+    placeParticle(cells.nextMaterial, a, typeB, motion);
+    placeParticle(cells.nextMaterial, b, typeA, motion);
+
+    const MaterialRules &rules = materialRules();
+    unsigned char attributes = rules.attributes(typeA) | rules.attributes(typeB);
+    if (attributes & CARRIES_VELOCITY) {
+        std::swap(cells.velocity[a], cells.velocity[b]);
+    }
+    if (attributes & CARRIES_COLOR_VARIATION) {
+        std::swap(cells.colorVariation[a], cells.colorVariation[b]);
+    }
+}
+
+// a particle trades places with the lighter liquid under it, e.g. sand sinking through
+// water, and neither of them keeps falling
+template <typename GridT>
+void sinkParticle(CellStore<GridT> &cells, int i, int particleType, int liquid, int liquidType, MotionState<GridT> &motion)
+{
+    swapParticles(cells, i, particleType, liquid, liquidType, motion);
+    cells.velocity[i] = 0;
+    cells.velocity[liquid] = 0;
+}
+
+// a new particle in cell i of a material grid, with the attributes it carries reset
+template <typename GridT>
+void spawnParticle(CellStore<GridT> &cells, GridT &materials, int i, int particleType, MotionState<GridT> &motion, int step)
+{
+    placeParticle(materials, i, particleType, motion);
+    unsigned char attributes = materialRules().attributes(particleType);
+    if (attributes & CARRIES_VELOCITY) {
+        cells.velocity[i] = 0;
+    }
+    if (attributes & CARRIES_COLOR_VARIATION) {
+        cells.colorVariation[i] = spawnColorVariation(materials.column(i), materials.row(i), step);
+    }
+}
+
+// a particle reacts with the neighbour it landed on, see materialReactions. both cells of
+// the next grid get fresh particles of whatever they turned into
+template <typename GridT>
+void reactParticles(CellStore<GridT> &cells, int i, int particleType, int neighbor, int neighborType,
+                    MotionState<GridT> &motion, int step)
+{
+    const MaterialRules &rules = materialRules();
+    spawnParticle(cells, cells.nextMaterial, i, rules.becomes(particleType, neighborType), motion, step);
+    spawnParticle(cells, cells.nextMaterial, neighbor, rules.neighborBecomes(particleType, neighborType), motion, step);
+}
+
+// the starting world of a width x height canvas, drawn into the rectangle of the grid
+// whose bottom left cell is (left, bottom)
+template <typename GridT>
+void generateCanvas(GridT &materials, unsigned int left, unsigned int bottom, unsigned int width, unsigned int height) {
+    unsigned int i = 0;
+    for(unsigned int col = 0; col < width; col++) {
+        for(unsigned int row = 0; row < height; row++) {
+
+            // create wall on the bottom
+            if (col <= 20) {
+                materials[materials.index(left + i % width, bottom + i / width)] = WALL;
+            }
+
+            i++;
+        }
+    }
+}
+
+template <typename GridT>
+void generateCanvas(GridT &materials) {
+    generateCanvas(materials, 0, 0, materials.width(), materials.height());
+}
+
+template <typename GridT>
+void initializeMotion(CellStore<GridT> &cells, MotionState<GridT> &motion) {
+    motion.occupancy.reset();
+    motion.sleep.reset();
+    cells.velocity.fill(0);
+    cells.colorVariation.fill(0);
+    for (unsigned int y = 0; y < cells.height(); y++) {
+        for (unsigned int x = 0; x < cells.width(); x++) {
+            if (cells.material[cells.material.index(x, y)] != EMPTY) {
+                motion.occupancy.set(x, y);
+            }
+        }
+    }
+}
+
+// cells covered by a 10x10 brush hanging down and to the right of the cursor, clipped
+// to the canvas so it never touches the border. columns left..right-1, rows bottom..top
+struct BrushArea {
+    int left;
+    int right;
+    int bottom;
+    int top;
+};
+
+inline BrushArea brushArea(unsigned int width, unsigned int height, double xpos, double ypos) {
+    // access current pixel
+    double translatedYPos = std::abs(height - ypos);
+    BrushArea area;
+    area.left = std::max((int)xpos, 0);
+    area.right = std::min((int)xpos + 10, (int)width);
+    area.top = (int)translatedYPos;
+    area.bottom = std::max(area.top - 9, 0);
+    area.top = std::min(area.top, (int)height - 1);
+    return area;
+}
+
+// fill a brush area with particles of one type. the area is in the coordinates of a
+// canvas whose bottom left cell sits at (left, bottom) of the grid
+template <typename GridT>
+void paintArea(CellStore<GridT> &cells, const BrushArea &area, unsigned int left, unsigned int bottom, int particleType,
+               MotionState<GridT> &motion, int step) {
+    GridT &currentCanvas = cells.material;
+    unsigned char attributes = materialRules().attributes(particleType);
+    for (int y = area.bottom; y <= area.top; y++) {
+        for (int x = area.left; x < area.right; x++) {
+            int index = currentCanvas.index(left + x, bottom + y);
+            placeParticle(currentCanvas, index, particleType, motion);
+            if (attributes & CARRIES_VELOCITY) {
+                cells.velocity[index] = 0;
+            }
+            if (attributes & CARRIES_COLOR_VARIATION) {
+                cells.colorVariation[index] = spawnColorVariation(x, y, step);
+            }
+        }
+    }
+}
+
+// paint the brush at a window position with particles of one type
+template <typename GridT>
+BrushArea draw(CellStore<GridT> &cells, double xpos, double ypos, int particleType, MotionState<GridT> &motion, int step) {
+    BrushArea area = brushArea(cells.width(), cells.height(), xpos, ypos);
+    paintArea(cells, area, 0, 0, particleType, motion, step);
+    return area;
+}
+
+// move a particle that has empty space below it down by its fall speed, stopping on top
+// of the first occupied cell. the landing row comes from the column occupancy bits so a
+// long fall costs the same as a one row fall
+template <typename GridT>
+void fallParticle(int i, CellStore<GridT> &cells, int particleType, MotionState<GridT> &motion) {
+    GridT &canvasData = cells.nextMaterial;
+    unsigned int x = canvasData.column(i);
+    unsigned int y = canvasData.row(i);
+
+    // accelerate
+    unsigned int speed = cells.velocity[i] + 1;
+    if (speed > MAX_FALL_SPEED) {
+        speed = MAX_FALL_SPEED;
+    }
+
+    unsigned int landingRow = motion.occupancy.landingRow(x, y, speed);
+    int landing = canvasData.index(x, landingRow);
+
+    moveParticle(cells, i, landing, particleType, motion);
+    cells.velocity[landing] = speed;
+}
+
+// a powder or liquid particle: whatever neighborhoodRules() has it do among the cells
+// around it. the cells below and to the left were already swept and are read from the
+// next grid, the one to the right from the current grid
+template <typename GridT>
+void processParticle(int i, int particleType, CellStore<GridT> &cells, MotionState<GridT> &motion, int step) {
+    const GridT &currentCanvas = cells.material;
+    GridT &canvasData = cells.nextMaterial;
+
+    int down = canvasData.down(i);
+    int downLeft = canvasData.downLeft(i);
+    int downRight = canvasData.downRight(i);
+    int downType = canvasData[down];
+    ParticleAction action = neighborhoodRules().action(particleType, downType, canvasData[downLeft], canvasData[downRight],
+                                                       canvasData[canvasData.left(i)], currentCanvas[canvasData.right(i)],
+                                                       motion.flowing);
+    if (action == ACTION_FALL) {
+        // fall as far as the current fall speed allows
+        fallParticle(i, cells, particleType, motion);
+        return;
+    }
+    if (action == ACTION_REACT) {
+        reactParticles(cells, i, particleType, down, downType, motion, step);
+        return;
+    }
+
+    // anything else stops the fall
+    cells.velocity[i] = 0;
+
+    switch (action) {
+    case ACTION_SINK:
+        sinkParticle(cells, i, particleType, down, downType, motion);
+        break;
+    case ACTION_SINK_DOWN_LEFT:
+        sinkParticle(cells, i, particleType, downLeft, canvasData[downLeft], motion);
+        break;
+    case ACTION_SINK_DOWN_RIGHT:
+        sinkParticle(cells, i, particleType, downRight, canvasData[downRight], motion);
+        break;
+    case ACTION_MOVE_DOWN_LEFT:
+        moveParticle(cells, i, downLeft, particleType, motion);
+        break;
+    case ACTION_MOVE_DOWN_RIGHT:
+        moveParticle(cells, i, downRight, particleType, motion);
+        break;
+    case ACTION_MOVE_LEFT:
+        moveParticle(cells, i, canvasData.left(i), particleType, motion);
+        break;
+    case ACTION_MOVE_RIGHT:
+        moveParticle(cells, i, canvasData.right(i), particleType, motion);
+        break;
+    case ACTION_WAIT:
+        // a thick liquid waits for its next sideways step
+        canvasData[i] = (unsigned char)particleType;
+        if (!motion.waiting.load(std::memory_order_relaxed)) {
+            motion.waiting.store(true, std::memory_order_relaxed);
+        }
+        break;
+    default:
+        // draw in same spot (piling up)
+        canvasData[i] = (unsigned char)particleType;
+        motion.sleep.idle(i);
+        break;
+    }
+}
+
+// write the display colors of columns firstColumn..lastColumn-1 of one row of a material
+// grid to out[firstColumn..]. color variation is only looked up for materials that carry it
+template <typename GridT>
+void renderRowSpan(const GridT &materials, const typename GridT::template Rebind<signed char> &colorVariation,
+                   unsigned int y, unsigned int firstColumn, unsigned int lastColumn, Rgba8 *out) {
+    const ColorTable &colors = colorTable();
+    int i = materials.index(firstColumn, y);
+    for (unsigned int x = firstColumn; x < lastColumn; x++, i = materials.right(i)) {
+        int particleType = materials[i];
+        int variation = 0;
+        if (materialRules().attributes(particleType) & CARRIES_COLOR_VARIATION) {
+            variation = colorVariation[i];
+        }
+        streamColor(out + x, colors.color(particleType, variation));
+    }
+}
+
+// write the display colors of one row of a material grid
+template <typename GridT>
+void renderRow(const GridT &materials, const typename GridT::template Rebind<signed char> &colorVariation,
+               unsigned int y, Rgba8 *out) {
+    renderRowSpan(materials, colorVariation, y, 0, materials.width(), out);
+}
+
+// display colors of the whole current grid, row-major with row 0 at the bottom
+template <typename GridT>
+void renderCanvas(const CellStore<GridT> &cells, Rgba8 *out) {
+    for (unsigned int y = 0; y < cells.height(); y++) {
+        renderRow(cells.material, cells.colorVariation, y, out + (size_t)y * cells.width());
+    }
+    finishStreaming();
+}
+
+// advance the particle in cell i of the current grid into the next grid
+template <typename GridT>
+void updateCell(int i, CellStore<GridT> &cells, MotionState<GridT> &motion, int step) {
+    const GridT &currentCanvas = cells.material;
+    GridT &canvasData = cells.nextMaterial;
+
+    // settled particle with nothing changing around it, just carry it over
+    if (motion.sleep.asleep(i)) {
+        canvasData[i] = currentCanvas[i];
+        return;
+    }
+
+    // access current cell
+    int oldParticleType = currentCanvas[i];
+    int updatedParticleType = canvasData[i];
+
+    // need to check if particle from last update moved into this position
+    if (oldParticleType == EMPTY && updatedParticleType != EMPTY) {
+        return;
+    } else {
+        if (materialRules().state(oldParticleType) == STATIC) {
+            canvasData[i] = (unsigned char)oldParticleType;
+        } else {
+            processParticle(i, oldParticleType, cells, motion, step);
+        }
+    }
+}
+
+// one simulation tick from cells.material into cells.nextMaterial, which is cleared
+// first so only particles that moved in this tick show up as non-empty. the sweep only
+// streams the two material grids; cold attributes are read and written by the kernels
+// for the few cells that actually move.
+// the display colors for the new state are written in the same sweep. nothing processed
+// in row y writes further down than y - MAX_FALL_SPEED, so once row y is done the row
+// MAX_FALL_SPEED below it is final and still in cache, and its colors go straight out.
+// the grid is only streamed from memory once per tick instead of once more for rendering
+template <typename GridT>
+void updateCanvas(CellStore<GridT> &cells, MotionState<GridT> &motion, int step, Rgba8 *colors) {
+    const GridT &currentCanvas = cells.material;
+    GridT &canvasData = cells.nextMaterial;
+    canvasData.fillInterior(EMPTY);
+
+    for (unsigned int y = 0; y < currentCanvas.height(); y++) {
+        int i = currentCanvas.index(0, y);
+        for (unsigned int x = 0; x < currentCanvas.width(); x++, i = currentCanvas.right(i)) {
+            updateCell(i, cells, motion, step);
+        }
+
+        if (y >= MAX_FALL_SPEED) {
+            unsigned int finishedRow = y - MAX_FALL_SPEED;
+            renderRow(canvasData, cells.colorVariation, finishedRow, colors + (size_t)finishedRow * currentCanvas.width());
+        }
+    }
+
+    // the top rows only settle once the sweep is over
+    unsigned int height = currentCanvas.height();
+    for (unsigned int y = height > MAX_FALL_SPEED ? height - MAX_FALL_SPEED : 0; y < height; y++) {
+        renderRow(canvasData, cells.colorVariation, y, colors + (size_t)y * currentCanvas.width());
+    }
+    finishStreaming();
+}
+
+// the materials side of a heat pass over the current grid: heaters are held at their
+// temperature, water boils, steam condenses and sand melts into glass. changes go
+// through placeParticle like any move does. returns whether a heater appeared or went
+// away; first and last get the rows whose materials changed, first > last if none did
+template <typename GridT>
+bool applyHeat(CellStore<GridT> &cells, MotionState<GridT> &motion, HeatField &heat, int step,
+               unsigned int &first, unsigned int &last) {
+    GridT &materials = cells.material;
+    bool heated = false;
+    first = 1;
+    last = 0;
+    for (unsigned int y = 0; y < cells.height(); y++) {
+        short *temperature = heat.row(y);
+        short *held = heat.heldRow(y);
+        bool rowChanged = false;
+        int i = materials.index(0, y);
+        for (unsigned int x = 0; x < cells.width(); x++, i = materials.right(i)) {
+            int particleType = materials[i];
+            if (particleType == HEATER) {
+                // from now on the stencil leaves it at its temperature
+                if (held[x] != HEATER_TEMPERATURE) {
+                    held[x] = HEATER_TEMPERATURE;
+                    temperature[x] = HEATER_TEMPERATURE;
+                    heated = true;
+                }
+                continue;
+            }
+            if (held[x] == HEATER_TEMPERATURE) {
+                // the heater was erased, the cell cools like any other
+                held[x] = 0;
+                heated = true;
+            }
+            int becomes = heatedMaterial(particleType, temperature[x]);
+            if (becomes == particleType) {
+                continue;
+            }
+            spawnParticle(cells, materials, i, becomes, motion, step);
+            rowChanged = true;
+        }
+        if (rowChanged) {
+            first = first > last ? y : first;
+            last = y;
+        }
+    }
+    return heated;
+}
+
+// a particle that was flying lands in empty cell i of the current grid, keeping its shade
+template <typename GridT>
+void depositParticle(CellStore<GridT> &cells, int i, int particleType, signed char variation, MotionState<GridT> &motion)
+{
+    placeParticle(cells.material, i, particleType, motion);
+    unsigned char attributes = materialRules().attributes(particleType);
+    if (attributes & CARRIES_VELOCITY) {
+        cells.velocity[i] = 0;
+    }
+    if (attributes & CARRIES_COLOR_VARIATION) {
+        cells.colorVariation[i] = variation;
+    }
+}
+
+// take the particle in cell (x, y) of the current grid into the air with a velocity in
+// cells per tick. false for static materials, nothing is lifted out of a wall, and when
+// too many particles are flying already
+template <typename GridT>
+bool liftParticle(CellStore<GridT> &cells, unsigned int x, unsigned int y, float vx, float vy, FreeParticles &flying,
+                  MotionState<GridT> &motion)
+{
+    int i = cells.material.index(x, y);
+    int particleType = cells.material[i];
+    if (materialRules().state(particleType) == STATIC) {
+        return false;
+    }
+    signed char variation = 0;
+    if (materialRules().attributes(particleType) & CARRIES_COLOR_VARIATION) {
+        variation = cells.colorVariation[i];
+    }
+    if (!flying.add(x + 0.5f, y + 0.5f, vx, vy, (unsigned char)particleType, variation)) {
+        return false;
+    }
+    placeParticle(cells.material, i, EMPTY, motion);
+    return true;
+}
+
+// the nearest empty cell to (x, y) that can be got to through cells of powders and
+// liquids, as y * width + x. walls and other static cells are in the way. -1 if there's
+// none among the LANDING_SEARCH_CELLS nearest
+template <typename GridT>
+int findLanding(const GridT &materials, int x, int y, LandingSearch &search)
+{
+    int width = (int)materials.width();
+    int height = (int)materials.height();
+    if (search.queuedBy.empty()) {
+        search.queuedBy.assign((size_t)width * height, 0);
+    }
+    if (++search.search == 0) {
+        std::fill(search.queuedBy.begin(), search.queuedBy.end(), 0);
+        search.search = 1;
+    }
+    search.queue.clear();
+    search.queue.push_back(y * width + x);
+    search.queuedBy[y * width + x] = search.search;
+    // breadth first, up before the sides before down
+    const int STEPS[4][2] = { { 0, 1 }, { -1, 0 }, { 1, 0 }, { 0, -1 } };
+    for (size_t q = 0; q < search.queue.size() && q < LANDING_SEARCH_CELLS; q++) {
+        int cellX = search.queue[q] % width;
+        int cellY = search.queue[q] / width;
+        for (int s = 0; s < 4; s++) {
+            int nextX = cellX + STEPS[s][0];
+            int nextY = cellY + STEPS[s][1];
+            if (nextX < 0 || nextY < 0 || nextX >= width || nextY >= height ||
+                search.queuedBy[nextY * width + nextX] == search.search) {
+                continue;
+            }
+            int particleType = materials[materials.index(nextX, nextY)];
+            if (particleType == EMPTY) {
+                return nextY * width + nextX;
+            }
+            if (materialRules().state(particleType) != STATIC) {
+                search.queuedBy[nextY * width + nextX] = search.search;
+                search.queue.push_back(nextY * width + nextX);
+            }
+        }
+    }
+    return -1;
+}
+
+// one tick of flight for the free particles. the ones that hit something on the way go
+// back into the current grid in the last empty cell along their path, except that one
+// landing fast in a liquid takes the liquid's cell and splashes the liquid up in its
+// place. none is ever lost: one whose cell filled up under it comes out in the nearest
+// empty cell it can get to (see findLanding), or waits in the air until there is one.
+// first and last get the rows whose cells changed, first > last if none did
+template <typename GridT>
+void landFreeParticles(CellStore<GridT> &cells, FreeParticles &flying, MotionState<GridT> &motion, LandingSearch &search,
+                       unsigned int &first, unsigned int &last) {
+    const GridT &materials = cells.material;
+    int width = (int)cells.width();
+    int height = (int)cells.height();
+    first = 1;
+    last = 0;
+    auto includeRow = [&first, &last](unsigned int y) {
+        first = first > last ? y : std::min(first, y);
+        last = std::max(last, y);
+    };
+    flying.integrate();
+    for (size_t p = 0; p < flying.size();) {
+        float startX = flying.fromX[p];
+        float startY = flying.fromY[p];
+        float dx = flying.x[p] - startX;
+        float dy = flying.y[p] - startY;
+        int lastX = (int)std::floor(startX);
+        int lastY = (int)std::floor(startY);
+
+        // the cell it was in may have filled up since, with it in the air above
+        if (materials[materials.index(lastX, lastY)] != EMPTY) {
+            int landing = findLanding(materials, lastX, lastY, search);
+            if (landing < 0) {
+                // no room nearby, it hangs where it was and tries again next tick
+                flying.x[p] = startX;
+                flying.y[p] = startY;
+                flying.vx[p] = 0;
+                flying.vy[p] = 0;
+                p++;
+                continue;
+            }
+            depositParticle(cells, materials.index(landing % width, landing / width), flying.material[p],
+                            flying.colorVariation[p], motion);
+            includeRow(landing / width);
+            flying.remove(p);
+            continue;
+        }
+
+        // walk the path a cell at a time up to the first one that's taken
+        bool hit = false;
+        int hitX = lastX;
+        int hitY = lastY;
+        int steps = (int)std::ceil(std::max(std::fabs(dx), std::fabs(dy)));
+        for (int s = 1; s <= steps && !hit; s++) {
+            int x = (int)std::floor(startX + dx * s / steps);
+            int y = (int)std::floor(startY + dy * s / steps);
+            if (x == lastX && y == lastY) {
+                continue;
+            }
+            // the border all round is wall
+            hit = x < 0 || y < 0 || x >= width || y >= height || materials[materials.index(x, y)] != EMPTY;
+            if (hit) {
+                hitX = x;
+                hitY = y;
+            } else {
+                lastX = x;
+                lastY = y;
+            }
+        }
+        if (!hit) {
+            p++;
+            continue;
+        }
+
+        float speed = std::sqrt(flying.vx[p] * flying.vx[p] + flying.vy[p] * flying.vy[p]);
+        bool splash = hitX >= 0 && hitY >= 0 && hitX < width && hitY < height &&
+                      materialRules().state(materials[materials.index(hitX, hitY)]) == LIQUID && speed >= SPLASH_SPEED;
+        if (splash) {
+            int liquid = materials.index(hitX, hitY);
+            int liquidType = materials[liquid];
+            signed char liquidVariation = cells.colorVariation[liquid];
+            depositParticle(cells, liquid, flying.material[p], flying.colorVariation[p], motion);
+
+            // the liquid carries on from the last empty cell as the particle that's flying
+            flying.x[p] = lastX + 0.5f;
+            flying.y[p] = lastY + 0.5f;
+            flying.vx[p] = flying.vx[p] * SPLASH_RESTITUTION;
+            flying.vy[p] = -flying.vy[p] * SPLASH_RESTITUTION;
+            flying.material[p] = (unsigned char)liquidType;
+            flying.colorVariation[p] = liquidVariation;
+            includeRow(hitY);
+            p++;
+        } else {
+            depositParticle(cells, materials.index(lastX, lastY), flying.material[p], flying.colorVariation[p], motion);
+            includeRow(lastY);
+            flying.remove(p);
+        }
+    }
+}
+
+// FNV-1a over the materials of a width x height rectangle in row-major order from its
+// bottom left cell at (left, bottom). walks the grid through its layout, so equal worlds
+// hash the same on any layout or wherever in a grid they sit
+template <typename GridT>
+uint64_t hashMaterials(const GridT &materials, unsigned int left, unsigned int bottom, unsigned int width, unsigned int height) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned int y = bottom; y < bottom + height; y++) {
+        int i = materials.index(left, y);
+        for (unsigned int x = 0; x < width; x++, i = materials.right(i)) {
+            hash = (hash ^ materials[i]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+template <typename GridT>
+uint64_t hashMaterials(const GridT &materials) {
+    return hashMaterials(materials, 0, 0, materials.width(), materials.height());
+}
+
+// stamps for when the tiles of a world changed, see copyChangedMaterials. they count
+// up across all worlds, so a world that starts stamping hands out newer ones than any
+// other world did before
+inline uint64_t nextChangeStamp()
+{
+    static std::atomic<uint64_t> stamp(0);
+    return ++stamp;
+}
+
+// what the window (or anything else driving the sandbox) talks to, so it doesn't need
+// to know which grid specialisation is running underneath
+class Simulation
+{
+public:
+    virtual ~Simulation() {}
+
+    virtual unsigned int width() const = 0;
+    virtual unsigned int height() const = 0;
+    // paint particles at a window position (y down from the top of the window)
+    virtual void draw(double xpos, double ypos, int particleType) = 0;
+    // advance the simulation by one tick. returns whether pixels() changed since the last
+    // call, so a viewer can skip uploading and redrawing identical frames
+    virtual bool update() = 0;
+    // nothing moved in the last tick and nothing has been drawn since. update() does no
+    // work in this state, a viewer can sleep until input arrives
+    virtual bool settled() const = 0;
+    // RGBA8 colors with row 0 at the bottom, ready for glTexImage2D with
+    // GL_RGBA/GL_UNSIGNED_BYTE. rows are pixelRowLength() pixels apart, upload with
+    // GL_UNPACK_ROW_LENGTH set to that
+    virtual const Rgba8 *pixels() const = 0;
+    virtual int pixelRowLength() const = 0;
+    // material of one cell, (0, 0) is the bottom left
+    virtual int material(unsigned int x, unsigned int y) const = 0;
+    // hash of every cell's material, the same for equal worlds whatever engine or memory
+    // layout is running them
+    virtual uint64_t materialHash() const = 0;
+    // every cell's material, width() per row with row 0 at the bottom
+    virtual void copyMaterials(unsigned char *out) const
+    {
+        for (unsigned int y = 0; y < height(); y++) {
+            for (unsigned int x = 0; x < width(); x++) {
+                *out++ = (unsigned char)material(x, y);
+            }
+        }
+    }
+    // copy into out, laid out as for copyMaterials, the cells of the tiles (see
+    // ChangedTiles) whose materials may have changed since the call that returned since,
+    // listing them in tiles from the bottom row up. returns the since for the next call.
+    // since 0, or one from before this world was first asked, gets every tile. engines
+    // that don't keep track copy every tile every time
+    virtual uint64_t copyChangedMaterials(unsigned char *out, uint64_t since, std::vector<TilePosition> &tiles)
+    {
+        copyMaterials(out);
+        tiles.clear();
+        for (unsigned int ty = 0; ty < (height() + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE; ty++) {
+            for (unsigned int tx = 0; tx < (width() + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE; tx++) {
+                TilePosition tile = { tx, ty };
+                tiles.push_back(tile);
+            }
+        }
+        return nextChangeStamp();
+    }
+    // add the cells of each material in the width x height rectangle whose bottom left
+    // cell is (x, y) to counts[MATERIAL_COUNT], clipped to the world. particles in the air
+    // aren't in the world, as for materialHash()
+    virtual void countMaterials(unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned int *counts)
+    {
+        unsigned int right = x + std::min(w, width() - std::min(x, width()));
+        unsigned int top = y + std::min(h, height() - std::min(y, height()));
+        for (unsigned int row = y; row < top; row++) {
+            for (unsigned int column = x; column < right; column++) {
+                counts[material(column, row)]++;
+            }
+        }
+    }
+    // cells of one material in a rectangle, see countMaterials
+    unsigned int countMaterial(int particleType, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+    {
+        unsigned int counts[MATERIAL_COUNT] = {};
+        countMaterials(x, y, w, h, counts);
+        return counts[particleType];
+    }
+    // nothing but empty cells in a rectangle, see countMaterials
+    bool regionClear(unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+    {
+        unsigned int counts[MATERIAL_COUNT] = {};
+        countMaterials(x, y, w, h, counts);
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            if (m != EMPTY && counts[m] > 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // throw the loose particles around a window position (as for draw) into the air.
+    // engines without free particles ignore it
+    virtual void blast(double xpos, double ypos) {}
+    // add the particles in the air to counts[MATERIAL_COUNT], by material. with those
+    // and countMaterials every cell thrown by a blast is accounted for
+    virtual void countMaterialsInAir(unsigned int *counts) const {}
+    // zoomed out views of the world, kept up to date from here on by update() and draw().
+    // NULL for engines that don't keep one
+    virtual MaterialPyramid *materialPyramid() { return NULL; }
+    // how the engine's worker threads spent their time since the last call, one line per
+    // worker. empty for engines that run on the calling thread
+    virtual std::string threadReport() { return std::string(); }
+};
+
+// the simulation running on one concrete material grid type
+template <typename GridT>
+class GridSimulation : public Simulation
+{
+public:
+    // firstTouch, if given, fills the grids from the threads that will sweep them
+    GridSimulation(unsigned int width, unsigned int height, const GridFirstTouch *firstTouch = NULL)
+        : cells(width, height, WALL, firstTouch), motion(cells.material, firstTouch), step(0),
+          colors((size_t)width * height), quiescent(false), drawnSinceUpdate(false), heat(width, height)
+    {
+        generateCanvas(cells.material);
+        initializeMotion(cells, motion);
+        renderCanvas(cells, colors.data());
+    }
+
+    unsigned int width() const { return cells.width(); }
+    unsigned int height() const { return cells.height(); }
+
+    void draw(double xpos, double ypos, int particleType)
+    {
+        BrushArea area = ::draw(cells, xpos, ypos, particleType, motion, step);
+        // the colors otherwise only change with the next tick
+        for (int y = area.bottom; y <= area.top; y++) {
+            renderRow(cells.material, cells.colorVariation, y, colors.data() + (size_t)y * cells.width());
+        }
+        finishStreaming();
+
+        refreshViews();
+        heat.noteDrawn(particleType);
+
+        quiescent = false;
+        drawnSinceUpdate = true;
+    }
+    // ------------------------------------------------------------------------
+    void blast(double xpos, double ypos)
+    {
+        // centered on the brush draw() would paint
+        int width = (int)cells.width();
+        int height = (int)cells.height();
+        float centerX = (float)xpos + 5.0f;
+        float centerY = (float)std::abs(height - ypos) - 4.0f;
+        int left = std::max((int)(centerX - BLAST_RADIUS), 0);
+        int right = std::min((int)(centerX + BLAST_RADIUS), width - 1);
+        int bottom = std::max((int)(centerY - BLAST_RADIUS), 0);
+        int top = std::min((int)(centerY + BLAST_RADIUS), height - 1);
+        for (int y = bottom; y <= top; y++) {
+            for (int x = left; x <= right; x++) {
+                float dx = x + 0.5f - centerX;
+                float dy = y + 0.5f - centerY;
+                float distance = std::sqrt(dx * dx + dy * dy);
+                if (distance > BLAST_RADIUS) {
+                    continue;
+                }
+                // straight out from the center, fastest close to it
+                float speed = BLAST_SPEED * (1.0f - distance / BLAST_RADIUS);
+                float vx = distance > 0 ? dx / distance * speed : 0;
+                float vy = distance > 0 ? dy / distance * speed : speed;
+                liftParticle(cells, x, y, vx, vy + BLAST_LIFT, flying, motion);
+            }
+        }
+        for (int y = bottom; y <= top; y++) {
+            renderRow(cells.material, cells.colorVariation, y, colors.data() + (size_t)y * cells.width());
+        }
+        drawFlying();
+        finishStreaming();
+        refreshViews();
+
+        quiescent = false;
+        drawnSinceUpdate = true;
+    }
+    // ------------------------------------------------------------------------
+    bool update()
+    {
+        // a settled world stays settled until something is drawn into it. the tick still
+        // counts, so a world's flow phase (see flowingMaterials) doesn't depend on how
+        // long it sat settled, or on whether a world packed next to it did
+        if (quiescent) {
+            step++;
+            return false;
+        }
+
+        motion.changed = false;
+        motion.waiting = false;
+        motion.flowing = flowingMaterials(step);
+        tick();
+        cells.material.swap(cells.nextMaterial);
+        step++;
+
+        updateHeat();
+        updateFreeParticles();
+        refreshViews();
+
+        quiescent = !motion.changed && !motion.waiting && heat.settled() && flying.empty();
+        bool changed = drawnSinceUpdate || !quiescent;
+        drawnSinceUpdate = false;
+        return changed;
+    }
+    // ------------------------------------------------------------------------
+    bool settled() const
+    {
+        return quiescent;
+    }
+    // ------------------------------------------------------------------------
+    const Rgba8 *pixels() const
+    {
+        return colors.data();
+    }
+    // ------------------------------------------------------------------------
+    int pixelRowLength() const
+    {
+        return cells.width();
+    }
+    // ------------------------------------------------------------------------
+    int material(unsigned int x, unsigned int y) const
+    {
+        return cells.material[cells.material.index(x, y)];
+    }
+    // ------------------------------------------------------------------------
+    uint64_t materialHash() const
+    {
+        return hashMaterials(cells.material);
+    }
+    // ------------------------------------------------------------------------
+    MaterialPyramid *materialPyramid()
+    {
+        // built on first use, so runs that never zoom out don't pay for it
+        if (!pyramid) {
+            // the counts, if any, take the changes so far before the pyramid starts afresh
+            refreshViews();
+            pyramid.reset(new MaterialPyramid(cells.width(), cells.height()));
+            pyramid->rebuild(MaterialSource(cells.material));
+            motion.changedTiles.clear();
+        }
+        return pyramid.get();
+    }
+    // ------------------------------------------------------------------------
+    void countMaterials(unsigned int x, unsigned int y, unsigned int w, unsigned int h, unsigned int *counts)
+    {
+        // kept from the first query on, like the pyramid
+        if (!histograms) {
+            refreshViews();
+            histograms.reset(new MaterialCounts(cells.width(), cells.height()));
+            histograms->rebuild(MaterialSource(cells.material));
+            motion.changedTiles.clear();
+        }
+        histograms->count(MaterialSource(cells.material), x, y, w, h, counts);
+    }
+    // ------------------------------------------------------------------------
+    void countMaterialsInAir(unsigned int *counts) const
+    {
+        for (size_t p = 0; p < flying.size(); p++) {
+            counts[flying.material[p]]++;
+        }
+    }
+    // ------------------------------------------------------------------------
+    void copyMaterials(unsigned char *out) const
+    {
+        for (unsigned int y = 0; y < cells.height(); y++) {
+            int i = cells.material.index(0, y);
+            for (unsigned int x = 0; x < cells.width(); x++, i = cells.material.right(i)) {
+                *out++ = cells.material[i];
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    uint64_t copyChangedMaterials(unsigned char *out, uint64_t since, std::vector<TilePosition> &tiles)
+    {
+        // stamped from the first call on, like the pyramid is kept from its first use
+        if (tileStamps.empty()) {
+            refreshViews();
+            tileStamps.assign((size_t)motion.changedTiles.width() * motion.changedTiles.height(), nextChangeStamp());
+            motion.changedTiles.clear();
+        } else {
+            refreshViews();
+        }
+        tiles.clear();
+        for (unsigned int ty = 0; ty < motion.changedTiles.height(); ty++) {
+            for (unsigned int tx = 0; tx < motion.changedTiles.width(); tx++) {
+                if (tileStamps[(size_t)ty * motion.changedTiles.width() + tx] > since) {
+                    TilePosition tile = { tx, ty };
+                    tiles.push_back(tile);
+                    copyTile(out, tx, ty);
+                }
+            }
+        }
+        return nextChangeStamp();
+    }
+
+protected:
+    // sweep cells.material into cells.nextMaterial and write the new colors
+    virtual void tick()
+    {
+        updateCanvas(cells, motion, step, colors.data());
+    }
+
+    CellStore<GridT> cells;
+    MotionState<GridT> motion;
+    int step;
+    // display colors of the current state, written by the update sweep
+    std::vector<Rgba8> colors;
+    bool quiescent;
+    bool drawnSinceUpdate;
+    std::unique_ptr<MaterialPyramid> pyramid;
+    std::unique_ptr<MaterialCounts> histograms;
+    // tiles the last refreshViews() took from motion.changedTiles
+    std::vector<TilePosition> changedTileList;
+    // when each tile last changed, empty until copyChangedMaterials is first called
+    std::vector<uint64_t> tileStamps;
+    HeatField heat;
+    // particles in the air, drawn over colors
+    FreeParticles flying;
+    LandingSearch landing;
+
+    // the current grid's cells for the pyramid
+    struct MaterialSource {
+        const GridT &materials;
+        explicit MaterialSource(const GridT &materials) : materials(materials) {}
+        int operator()(unsigned int x, unsigned int y) const { return materials[materials.index(x, y)]; }
+    };
+
+    // bring the pyramid, the material counts and the tile stamps, those there are, up to
+    // date with the cells set since last time
+    void refreshViews()
+    {
+        if (!pyramid && !histograms && tileStamps.empty()) {
+            return;
+        }
+        motion.changedTiles.takeMarked(changedTileList);
+        if (pyramid) {
+            pyramid->update(MaterialSource(cells.material), changedTileList);
+        }
+        if (histograms) {
+            histograms->update(MaterialSource(cells.material), changedTileList);
+        }
+        if (!tileStamps.empty() && !changedTileList.empty()) {
+            uint64_t stamp = nextChangeStamp();
+            for (size_t t = 0; t < changedTileList.size(); t++) {
+                tileStamps[(size_t)changedTileList[t].y * motion.changedTiles.width() + changedTileList[t].x] = stamp;
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // the cells of tile (tx, ty) into out, laid out as for copyMaterials
+    void copyTile(unsigned char *out, unsigned int tx, unsigned int ty) const
+    {
+        unsigned int left = tx * PYRAMID_TILE_SIZE;
+        unsigned int bottom = ty * PYRAMID_TILE_SIZE;
+        unsigned int right = std::min(left + PYRAMID_TILE_SIZE, cells.width());
+        unsigned int top = std::min(bottom + PYRAMID_TILE_SIZE, cells.height());
+        for (unsigned int y = bottom; y < top; y++) {
+            unsigned char *row = out + (size_t)y * cells.width();
+            int i = cells.material.index(left, y);
+            for (unsigned int x = left; x < right; x++, i = cells.material.right(i)) {
+                row[x] = cells.material[i];
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    // a heat pass if one is due, after the tick's sweep rather than inside it
+    void updateHeat()
+    {
+        if (motion.changed || drawnSinceUpdate) {
+            heat.noteMoved();
+        }
+        if (!heat.due(step)) {
+            return;
+        }
+        bool changed = heat.diffuse();
+        unsigned int first, last;
+        changed = applyHeat(cells, motion, heat, step, first, last) || changed;
+        for (unsigned int y = first; y <= last; y++) {
+            renderRow(cells.material, cells.colorVariation, y, colors.data() + (size_t)y * cells.width());
+        }
+        finishStreaming();
+        heat.finishPass(changed);
+    }
+    // ------------------------------------------------------------------------
+    // fly the free particles after the tick's sweep, the ones that land go back into the
+    // grid and the rest are drawn over it
+    void updateFreeParticles()
+    {
+        if (flying.empty()) {
+            return;
+        }
+        unsigned int first, last;
+        landFreeParticles(cells, flying, motion, landing, first, last);
+        for (unsigned int y = first; y <= last; y++) {
+            renderRow(cells.material, cells.colorVariation, y, colors.data() + (size_t)y * cells.width());
+        }
+        drawFlying();
+        finishStreaming();
+    }
+    // ------------------------------------------------------------------------
+    void drawFlying()
+    {
+        const ColorTable &table = colorTable();
+        for (size_t p = 0; p < flying.size(); p++) {
+            size_t x = (size_t)flying.x[p];
+            size_t y = (size_t)flying.y[p];
+            colors[y * cells.width() + x] = table.color(flying.material[p], flying.colorVariation[p]);
+        }
+    }
+};
+
+#endif
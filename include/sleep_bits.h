@@ -0,0 +1,64 @@
+#ifndef SLEEP_BITS_H
+#define SLEEP_BITS_H
+
+#include <../include/grid.h>
+
+// settled particles stop being simulated until something next to them changes.
+// each cell keeps a small idle counter and an asleep bit in one byte; a cell that
+// has stayed put for SLEEP_AFTER_TICKS ticks in a row is skipped by the update with
+// a single bit test, and any change in its 3x3 neighbourhood wakes it back up.
+// the bytes live in a grid shaped like the canvas so they share its indices
+template <typename GridT>
+class SleepBits
+{
+public:
+    static const unsigned char ASLEEP = 0x80;
+    static const unsigned char IDLE_MASK = 0x7f;
+    static const unsigned char SLEEP_AFTER_TICKS = 3;
+
+    SleepBits(unsigned int width, unsigned int height, const GridFirstTouch *firstTouch = NULL)
+        : state(width, height, 0, gridFill(firstTouch))
+    {
+        if (firstTouch != NULL) {
+            firstTouch->touchColumns(width + 2, [this](unsigned int first, unsigned int last) {
+                state.fillColumns(first, last, 0, 0);
+            });
+        }
+    }
+
+    bool asleep(int cell) const
+    {
+        return state[cell] & ASLEEP;
+    }
+    // ------------------------------------------------------------------------
+    // the particle in this cell had nowhere to go this tick
+    void idle(int cell)
+    {
+        unsigned char idleTicks = (state[cell] & IDLE_MASK) + 1;
+        state[cell] = idleTicks >= SLEEP_AFTER_TICKS ? (ASLEEP | SLEEP_AFTER_TICKS) : idleTicks;
+    }
+    // ------------------------------------------------------------------------
+    // the cell changed, so it and its neighbours have to be looked at again. the grid
+    // has a border around the interior so all eight neighbours are always in range
+    void wake(int cell)
+    {
+        state[state.downLeft(cell)] = 0;
+        state[state.down(cell)] = 0;
+        state[state.downRight(cell)] = 0;
+        state[state.left(cell)] = 0;
+        state[cell] = 0;
+        state[state.right(cell)] = 0;
+        state[state.upLeft(cell)] = 0;
+        state[state.up(cell)] = 0;
+        state[state.upRight(cell)] = 0;
+    }
+    // ------------------------------------------------------------------------
+    void reset()
+    {
+        state.fill(0);
+    }
+
+private:
+    typename GridT::template Rebind<unsigned char> state;
+};
+#endif
@@ -0,0 +1,106 @@
+#ifndef STEALING_SIMULATION_H
+#define STEALING_SIMULATION_H
+
+#include <../include/numa_topology.h>
+#include <../include/parallel_simulation.h>
+#include <../include/simulation.h>
+#include <../include/work_stealing.h>
+#include <../include/worker_pool.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+// multithreaded sweep for worlds where the work is very uneven, e.g. one waterfall in an
+// otherwise empty sky. the static strips of the parallel engine leave every worker whose
+// strip is sky idle; here the sweep is cut into many small tiles that the workers take
+// from each other as they run out (see WavefrontScheduler).
+// the tiles are parallelograms leaning TILE_SKEW columns to the left per row up: tile
+// (u, v) holds the cells of rows v * TILE_ROWS.. whose x + TILE_SKEW * y falls into
+// u * TILE_SPAN... everything a cell touches is at most 2 columns away (a particle moves
+// one column, the sleep bits it wakes are one further), so two cells that touch the same
+// memory are at most 4 columns apart. with 5 columns of lean per row, a cell the serial
+// sweep handles earlier on a lower row always has a smaller x + 5y than the cell it
+// shares memory with, and so does one to its left on the same row. tiles that are done
+// before their right and upper neighbours start therefore keep every pair of cells that
+// share memory in serial order, and the worlds come out exactly as on one thread
+const int TILE_SKEW = 5;
+// width of a tile along x + TILE_SKEW * y
+const int TILE_SPAN = 128;
+const int TILE_ROWS = 16;
+
+// the grid simulation with its sweep split into tiles that pinned workers steal
+template <typename GridT>
+class StealingGridSimulation : public GridSimulation<GridT>
+{
+public:
+    StealingGridSimulation(unsigned int width, unsigned int height, unsigned int workers = parallelWorkerCount())
+        : GridSimulation<GridT>(width, height), pool(cpusForWorkers(workers)), scheduler(pool)
+    {
+    }
+
+    std::string threadReport()
+    {
+        std::string report = scheduler.report();
+        scheduler.resetStatistics();
+        return report;
+    }
+
+protected:
+    void tick()
+    {
+        CellStore<GridT> &cells = this->cells;
+        int spans = ((int)cells.width() + TILE_SKEW * ((int)cells.height() - 1) + TILE_SPAN - 1) / TILE_SPAN;
+        int bands = ((int)cells.height() + TILE_ROWS - 1) / TILE_ROWS;
+        scheduler.run(spans, bands, [this](unsigned int span, unsigned int band) {
+            sweepTile(span, band);
+        });
+
+        // the world just read becomes the next tick's target once the grids are swapped,
+        // clear it while the new one is being rendered rather than in a pass of its own
+        pool.run([this, &cells](unsigned int worker) {
+            unsigned int height = cells.height();
+            unsigned int first = (unsigned int)((unsigned long long)height * worker / pool.size());
+            unsigned int last = (unsigned int)((unsigned long long)height * (worker + 1) / pool.size());
+            for (unsigned int y = first; y < last; y++) {
+                renderRow(cells.nextMaterial, cells.colorVariation, y, this->colors.data() + (size_t)y * cells.width());
+            }
+            cells.material.fillInteriorRows(EMPTY, first, last);
+            finishStreaming();
+        });
+    }
+
+private:
+    WorkerPool pool;
+    WavefrontScheduler scheduler;
+
+    // the serial sweep restricted to one tile, row by row, left to right
+    void sweepTile(unsigned int span, unsigned int band)
+    {
+        CellStore<GridT> &cells = this->cells;
+        const GridT &currentCanvas = cells.material;
+        unsigned int lastRow = std::min((band + 1) * TILE_ROWS, cells.height());
+        for (unsigned int y = band * TILE_ROWS; y < lastRow; y++) {
+            int left = std::max((int)span * TILE_SPAN - TILE_SKEW * (int)y, 0);
+            int right = std::min((int)(span + 1) * TILE_SPAN - TILE_SKEW * (int)y, (int)cells.width());
+            if (left >= right) {
+                continue;
+            }
+            int i = currentCanvas.index(left, y);
+            for (int x = left; x < right; x++, i = currentCanvas.right(i)) {
+                updateCell(i, cells, this->motion, this->step);
+            }
+        }
+    }
+};
+
+// the stealing engine for a canvas size, tiled memory when it's very wide like the
+// default one
+inline std::unique_ptr<Simulation> makeStealingSimulation(unsigned int width, unsigned int height)
+{
+    if (width >= TILED_LAYOUT_MIN_WIDTH) {
+        return std::unique_ptr<Simulation>(new StealingGridSimulation<Grid<unsigned char, DYNAMIC_EXTENT, DYNAMIC_EXTENT, TiledLayout> >(width, height));
+    }
+    return std::unique_ptr<Simulation>(new StealingGridSimulation<Grid<unsigned char> >(width, height));
+}
+#endif
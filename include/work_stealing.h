@@ -0,0 +1,198 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <../include/worker_pool.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// work-stealing scheduler for a wavefront of tasks. the tasks sit on a columns x rows
+// grid and task (c, r) may only start once (c - 1, r) and (c, r - 1) are done, which is
+// the ordering a sweep needs when each task covers cells that depend on the ones to the
+// left and below. finishing a task makes at most its right and upper neighbours ready;
+// they go on the bottom of the finishing worker's deque, which it pops from the bottom
+// again, so a worker keeps walking into the cells next to the ones it just touched.
+// a worker with an empty deque steals from the top of someone else's, the oldest ready
+// task there and the one furthest from what its owner is working on.
+// busy regions produce expensive tasks and empty ones cheap tasks, so workers that keep
+// running into cheap ones simply end up stealing more
+
+// spins of an idle worker between looking for work before it yields the CPU
+const unsigned int STEAL_SPINS = 64;
+
+class WavefrontScheduler
+{
+public:
+    explicit WavefrontScheduler(WorkerPool &pool)
+        : pool(pool), queues(new WorkerQueue[pool.size()]), wallSeconds(0), runs(0)
+    {
+    }
+
+    // run task(column, row) for every task of a columns x rows wavefront, on the
+    // pool's workers, and return once they're all done
+    void run(unsigned int columns, unsigned int rows, const std::function<void(unsigned int, unsigned int)> &task)
+    {
+        if (columns == 0 || rows == 0) {
+            return;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        this->columns = columns;
+        this->rows = rows;
+        this->task = &task;
+        if (pending.size() < (size_t)columns * rows) {
+            pending = std::vector<std::atomic<unsigned char> >((size_t)columns * rows);
+        }
+        for (unsigned int r = 0; r < rows; r++) {
+            for (unsigned int c = 0; c < columns; c++) {
+                pending[(size_t)r * columns + c].store((c > 0) + (r > 0), std::memory_order_relaxed);
+            }
+        }
+        remaining.store((size_t)columns * rows, std::memory_order_relaxed);
+        queues[0].tasks.push_back(0);
+
+        pool.run([this](unsigned int worker) {
+            work(worker);
+        });
+
+        wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        runs++;
+    }
+    // ------------------------------------------------------------------------
+    // tasks run, tasks stolen and share of the wall time spent in tasks for every
+    // worker since the last reset, one line each
+    std::string report() const
+    {
+        std::string report;
+        for (unsigned int worker = 0; worker < pool.size(); worker++) {
+            const WorkerQueue &queue = queues[worker];
+            char line[128];
+            snprintf(line, sizeof(line), "worker %2u (cpu %d): %5.1f%% busy, %llu tasks, %llu stolen\n", worker,
+                     pool.cpu(worker), wallSeconds > 0 ? 100.0 * queue.busySeconds / wallSeconds : 0.0,
+                     (unsigned long long)queue.executed, (unsigned long long)queue.stolen);
+            report += line;
+        }
+        char line[96];
+        snprintf(line, sizeof(line), "%llu wavefronts, %.3f s", (unsigned long long)runs, wallSeconds);
+        return report + line;
+    }
+    // ------------------------------------------------------------------------
+    void resetStatistics()
+    {
+        for (unsigned int worker = 0; worker < pool.size(); worker++) {
+            queues[worker].executed = 0;
+            queues[worker].stolen = 0;
+            queues[worker].busySeconds = 0;
+        }
+        wallSeconds = 0;
+        runs = 0;
+    }
+
+private:
+    // a worker's ready tasks and what it did. only the owner pushes and pops at the
+    // bottom, thieves take from the top; the lock is almost never contended
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        std::deque<unsigned int> tasks;
+        uint64_t executed;
+        uint64_t stolen;
+        double busySeconds;
+
+        WorkerQueue() : executed(0), stolen(0), busySeconds(0) {}
+    };
+
+    WorkerPool &pool;
+    std::unique_ptr<WorkerQueue[]> queues;
+    unsigned int columns;
+    unsigned int rows;
+    const std::function<void(unsigned int, unsigned int)> *task;
+    // unfinished dependencies of every task
+    std::vector<std::atomic<unsigned char> > pending;
+    std::atomic<size_t> remaining;
+    double wallSeconds;
+    uint64_t runs;
+
+    bool popBottom(unsigned int worker, unsigned int &found)
+    {
+        WorkerQueue &queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        found = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    bool steal(unsigned int worker, unsigned int &found)
+    {
+        for (unsigned int offset = 1; offset < pool.size(); offset++) {
+            WorkerQueue &victim = queues[(worker + offset) % pool.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                found = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    // ------------------------------------------------------------------------
+    // a dependency of task (c, r) is done, queue the task if it was the last one
+    void release(unsigned int worker, unsigned int c, unsigned int r)
+    {
+        unsigned int index = r * columns + c;
+        if (pending[index].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(queues[worker].mutex);
+            queues[worker].tasks.push_back(index);
+        }
+    }
+    // ------------------------------------------------------------------------
+    void work(unsigned int worker)
+    {
+        WorkerQueue &queue = queues[worker];
+        unsigned int spins = 0;
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            unsigned int index;
+            if (!popBottom(worker, index)) {
+                if (!steal(worker, index)) {
+                    if (++spins < STEAL_SPINS) {
+                        spinPause();
+                    } else {
+                        std::this_thread::yield();
+                    }
+                    continue;
+                }
+                queue.stolen++;
+            }
+            spins = 0;
+
+            unsigned int c = index % columns;
+            unsigned int r = index / columns;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            (*task)(c, r);
+            queue.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            queue.executed++;
+
+            // upper neighbour first so the right one is popped next, staying on the rows
+            // that are already in cache
+            if (r + 1 < rows) {
+                release(worker, c, r + 1);
+            }
+            if (c + 1 < columns) {
+                release(worker, c + 1, r);
+            }
+            remaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+};
+#endif
@@ -0,0 +1,107 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <../include/numa_topology.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// busy-wait hint for a spin loop, eases off the sibling hyperthread
+inline void spinPause()
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    _mm_pause();
+#endif
+}
+
+// threads that live as long as the pool, each pinned to one CPU for its whole life.
+// run() hands the same job to every worker and returns once all of them are done, so a
+// job that splits its work by worker number gives each worker the same share every time
+// and the memory that share touches stays on the worker's node
+class WorkerPool
+{
+public:
+    // one worker per CPU in the list, a negative CPU leaves that worker unpinned
+    explicit WorkerPool(const std::vector<int> &cpus)
+        : cpus(cpus), job(NULL), generation(0), running(0), stopping(false)
+    {
+        for (size_t worker = 0; worker < cpus.size(); worker++) {
+            threads.push_back(std::thread(&WorkerPool::workerLoop, this, (unsigned int)worker));
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    unsigned int size() const { return (unsigned int)threads.size(); }
+    int cpu(unsigned int worker) const { return cpus[worker]; }
+
+    // call job(worker) on every worker and wait for all of them to return
+    void run(const std::function<void(unsigned int)> &work)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &work;
+        running = size();
+        generation++;
+        wake.notify_all();
+        finished.wait(lock, [this] { return running == 0; });
+        job = NULL;
+    }
+
+private:
+    std::vector<int> cpus;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(unsigned int)> *job;
+    // bumped for every run() so a worker never runs the same job twice
+    uint64_t generation;
+    unsigned int running;
+    bool stopping;
+
+    void workerLoop(unsigned int worker)
+    {
+        if (cpus[worker] >= 0) {
+            pinCurrentThread(cpus[worker]);
+        }
+
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            const std::function<void(unsigned int)> *work = job;
+
+            lock.unlock();
+            (*work)(worker);
+            lock.lock();
+
+            if (--running == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+};
+#endif
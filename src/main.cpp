@@ -3,23 +3,32 @@
 #include <../include/stb_image.h>
 
 #include <../include/shader.h>
-
+#include <../include/benchmark.h>
+#include <../include/command_queue.h>
+#include <../include/differential_fuzzer.h>
+#include <../include/engines.h>
+#include <../include/frame_exporter.h>
+#include <../include/frame_stream.h>
+#include <../include/golden.h>
+#include <../include/rewind_buffer.h>
+#include <../include/scenes.h>
+
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
-float *generateCanvas();
-float *updateCanvas(float *currentCanvas, int update);
-
-void processSand(int i, float *currentCanvas, float* canvasData, int step);
-void processWater(int i, float *currentCanvas, float* canvasData, int step);
-
-float *draw(float *currentCanvas, double xpos, double ypos, int particleType);
-
-int getParticleType(float r, float g, float b, float a);
-void drawParticle(float *canvasLocation, int particleType);
+void window_refresh_callback(GLFWwindow *window);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 
 void initializeCanvas();
+int runHeadless(Simulation &simulation, unsigned int ticks, FrameExporter *exporter, unsigned int exportEvery,
+                FrameStreamServer *server);
+void uploadPyramidRows(const MaterialPyramid &pyramid, unsigned int level, unsigned int first, unsigned int last,
+                       std::vector<Rgba8> &colors);
 
 // settings
 const unsigned int SCR_WIDTH = 837;
@@ -28,15 +37,208 @@ const unsigned int SCR_HEIGHT = 600;
 // const unsigned int SCR_WIDTH = 100;
 // const unsigned int SCR_HEIGHT = 100;
 
-enum particleTypes{
-    EMPTY,
-    WALL,
-    SAND,
-    WATER
+// bigger worlds are shown zoomed out until they fit in a window this size
+const unsigned int MAX_WINDOW_WIDTH = 1920;
+const unsigned int MAX_WINDOW_HEIGHT = 1080;
+
+// set when the window has to be drawn again even though the canvas didn't change
+bool windowNeedsRedraw = true;
+
+// input commands posted from the window, applied by the simulation at the start of a tick
+const size_t INPUT_QUEUE_COMMANDS = 1024;
+CommandQueue inputCommands(INPUT_QUEUE_COMMANDS);
+// what the key bindings need to know to build commands
+struct KeyInputState {
+    unsigned int width;
+    unsigned int height;
+    std::string engine;
+    // watching a world streamed from elsewhere, there's no local one to reload
+    bool streamed;
+    // pause state last asked for, space toggles it
+    bool paused;
+    // ticks scrubbed back from the newest recorded frame, 0 shows the live world
+    unsigned int rewindTicks;
+    // material the left button paints, picked with the number keys
+    int brush;
+    // b was pressed, blast at the cursor
+    bool blast;
 };
+KeyInputState keyInput;
 
-int main()
+int main(int argc, char **argv)
 {
+    // canvas size, the window matches it. pass WIDTHxHEIGHT to run at another size
+    unsigned int width = SCR_WIDTH;
+    unsigned int height = SCR_HEIGHT;
+    // run this many ticks without a window instead, with scripted input
+    unsigned int headlessTicks = 0;
+    // write every exportEvery-th frame to exportDirectory
+    std::string exportDirectory;
+    unsigned int exportEvery = 1;
+    ExportFormat exportFormat = EXPORT_PNG;
+    unsigned int exportThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    // engine to run, see ENGINE_NAMES
+    std::string engine = "default";
+    // record the golden reference hashes to this file, or check the engine against it
+    std::string goldenRecordPath;
+    std::string goldenCheckPath;
+    // fuzz the engine against the reference engine for this many random cases
+    unsigned int fuzzCases = 0;
+    unsigned int fuzzSeed = 1;
+    // time this many ticks of the engine, with and without huge pages
+    unsigned int benchmarkTicks = 0;
+    // benchmark a batch of this many worlds of the canvas size instead, see runBatch
+    unsigned int batchWorlds = 0;
+    // publish frames to viewers on this socket, or be a viewer of the one on connectPath
+    std::string servePath;
+    std::string connectPath;
+    // megabytes of history the window keeps to scrub back through, 0 for none
+    unsigned int rewindMegabytes = 256;
+
+    bool usageError = false;
+    for (int arg = 1; arg < argc && !usageError; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--headless") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &headlessTicks) != 1 || headlessTicks == 0;
+        } else if (strcmp(argv[arg], "--export") == 0 && hasValue) {
+            exportDirectory = argv[++arg];
+        } else if (strcmp(argv[arg], "--export-every") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &exportEvery) != 1 || exportEvery == 0;
+        } else if (strcmp(argv[arg], "--export-format") == 0 && hasValue) {
+            arg++;
+            usageError = strcmp(argv[arg], "png") != 0 && strcmp(argv[arg], "raw") != 0;
+            exportFormat = strcmp(argv[arg], "raw") == 0 ? EXPORT_RAW : EXPORT_PNG;
+        } else if (strcmp(argv[arg], "--export-threads") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &exportThreads) != 1 || exportThreads == 0;
+        } else if (strcmp(argv[arg], "--engine") == 0 && hasValue) {
+            engine = argv[++arg];
+            usageError = !isEngineName(engine);
+        } else if (strcmp(argv[arg], "--golden-record") == 0 && hasValue) {
+            goldenRecordPath = argv[++arg];
+        } else if (strcmp(argv[arg], "--golden-check") == 0 && hasValue) {
+            goldenCheckPath = argv[++arg];
+        } else if (strcmp(argv[arg], "--fuzz") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &fuzzCases) != 1 || fuzzCases == 0;
+        } else if (strcmp(argv[arg], "--seed") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &fuzzSeed) != 1;
+        } else if (strcmp(argv[arg], "--bench") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &benchmarkTicks) != 1 || benchmarkTicks == 0;
+        } else if (strcmp(argv[arg], "--batch") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &batchWorlds) != 1 || batchWorlds == 0;
+        } else if (strcmp(argv[arg], "--serve") == 0 && hasValue) {
+            servePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--connect") == 0 && hasValue) {
+            connectPath = argv[++arg];
+        } else if (strcmp(argv[arg], "--rewind") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &rewindMegabytes) != 1;
+        } else if (strcmp(argv[arg], "--threads") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &parallelWorkerCount()) != 1 || parallelWorkerCount() == 0;
+        } else if (strcmp(argv[arg], "--heat-every") == 0 && hasValue) {
+            usageError = sscanf(argv[++arg], "%u", &heatInterval()) != 1 || heatInterval() == 0;
+        } else if (strcmp(argv[arg], "--no-huge-pages") == 0) {
+            gridHugePagesEnabled() = false;
+        } else {
+            usageError = sscanf(argv[arg], "%ux%u", &width, &height) != 2 || width < 2 || height < 2;
+        }
+    }
+    if (usageError) {
+        std::cout << "usage: " << argv[0] << " [WIDTHxHEIGHT] [--engine NAME] [--headless TICKS] [--export DIRECTORY]"
+                  << " [--export-every N] [--export-format png|raw] [--export-threads N]"
+                  << " [--golden-record FILE] [--golden-check FILE] [--fuzz CASES] [--seed N]"
+                  << " [--bench TICKS] [--batch WORLDS] [--serve SOCKET] [--connect SOCKET] [--threads N]"
+                  << " [--rewind MB] [--heat-every TICKS] [--no-huge-pages]" << std::endl;
+        std::cout << "engines:";
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            std::cout << " " << ENGINE_NAMES[e];
+        }
+        std::cout << std::endl;
+        return -1;
+    }
+
+    if (!goldenRecordPath.empty()) {
+        return recordGolden(goldenRecordPath) ? 0 : 1;
+    }
+    if (!goldenCheckPath.empty()) {
+        return checkGolden(goldenCheckPath, engine) ? 0 : 1;
+    }
+    if (fuzzCases > 0) {
+        return fuzzEngine(engine, fuzzCases, fuzzSeed) ? 0 : 1;
+    }
+    if (batchWorlds > 0) {
+        // ticks of the scripted pour to run when --bench doesn't say
+        const unsigned int BATCH_DEFAULT_TICKS = 500;
+        return runBatchBenchmark(width, height, batchWorlds, benchmarkTicks > 0 ? benchmarkTicks : BATCH_DEFAULT_TICKS);
+    }
+    if (benchmarkTicks > 0) {
+        return runBenchmarks(width, height, engine, benchmarkTicks);
+    }
+
+    // frames waiting for the encoders. past this the simulation drops frames rather than wait
+    const size_t EXPORT_QUEUE_FRAMES = 16;
+    std::unique_ptr<FrameExporter> exporter;
+    if (!exportDirectory.empty()) {
+        exporter.reset(new FrameExporter(exportDirectory, exportFormat, width, height, exportThreads, EXPORT_QUEUE_FRAMES));
+    }
+
+    // a viewer's window takes the size of the streamed world
+    std::unique_ptr<StreamedWorld> stream;
+    if (!connectPath.empty()) {
+        stream = StreamedWorld::connect(connectPath);
+        if (!stream) {
+            return 1;
+        }
+        width = stream->width();
+        height = stream->height();
+    }
+    std::unique_ptr<FrameStreamServer> server;
+    if (!servePath.empty()) {
+        server.reset(new FrameStreamServer(servePath, width, height));
+        if (!server->listening()) {
+            return 1;
+        }
+    }
+
+    if (headlessTicks > 0) {
+        std::unique_ptr<Simulation> simulation = makeSimulation(width, height, engine);
+        std::cout << gridMemoryReport() << std::endl;
+        return runHeadless(*simulation, headlessTicks, exporter.get(), exportEvery, server.get());
+    }
+
+    std::cout << "Generating canvas..."  << std::endl;
+    std::unique_ptr<Simulation> simulation;
+    // a viewer of a remote stream has no world of its own to load or blast
+    bool streamed = stream != NULL;
+    if (stream) {
+        simulation = std::move(stream);
+    } else {
+        simulation = makeSimulation(width, height, engine);
+    }
+    std::cout << "Finished generating canvas..."  << std::endl;
+    std::cout << gridMemoryReport() << std::endl;
+
+    // a world bigger than the screen is shown zoomed out, one level of its material
+    // pyramid, so only that level is uploaded and sampled
+    unsigned int zoomLevel = 0;
+    unsigned int windowWidth = width;
+    unsigned int windowHeight = height;
+    MaterialPyramid *pyramid = NULL;
+    if (width > MAX_WINDOW_WIDTH || height > MAX_WINDOW_HEIGHT) {
+        pyramid = simulation->materialPyramid();
+        if (pyramid == NULL) {
+            std::cout << "Engine " << engine << " can't zoom out, showing every cell" << std::endl;
+        } else {
+            while (pyramid->levelWidth(zoomLevel) > MAX_WINDOW_WIDTH || pyramid->levelHeight(zoomLevel) > MAX_WINDOW_HEIGHT) {
+                zoomLevel++;
+            }
+            windowWidth = pyramid->levelWidth(zoomLevel);
+            windowHeight = pyramid->levelHeight(zoomLevel);
+            std::cout << "Zoomed out " << (1u << zoomLevel) << "x to " << windowWidth << "x" << windowHeight << std::endl;
+        }
+    }
+    // colors of the zoomed out level, and a pyramid for recorded frames shown zoomed out
+    std::vector<Rgba8> levelColors((size_t)windowWidth * windowHeight);
+    std::unique_ptr<MaterialPyramid> rewindPyramid;
+
 	// glfw: initialize and configure
     std::cout << "Starting..."  << std::endl;
 	glfwInit();
@@ -49,7 +251,7 @@ int main()
 
 	// glfw window creation
     std::cout << "Creating window..."  << std::endl;
-	GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Sandy", NULL, NULL);
+	GLFWwindow *window = glfwCreateWindow(windowWidth, windowHeight, "Sandy", NULL, NULL);
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -58,6 +260,16 @@ int main()
 	}
 	glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSetKeyCallback(window, key_callback);
+    keyInput.width = width;
+    keyInput.height = height;
+    keyInput.engine = engine;
+    keyInput.streamed = streamed;
+    keyInput.paused = false;
+    keyInput.rewindTicks = 0;
+    keyInput.brush = SAND;
+    keyInput.blast = false;
 
 	// glad: load all OpenGL function pointers
     std::cout << "Loading OpenGL function pointers..."  << std::endl;
@@ -122,8 +334,6 @@ int main()
     // unbind buffer now that glVertexAttribPointer registered VBO as the vertex attribute's bound VBO
     // glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    float *canvasData = generateCanvas();
-
     std::cout << "Creating texture..."  << std::endl;
     unsigned int texture1;
     glGenTextures(1, &texture1);
@@ -131,11 +341,21 @@ int main()
     glBindTexture(GL_TEXTURE_2D, texture1);
     // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, canvasData);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // one cell per texel and no mipmaps: the texture only ever holds the level that fits
+    // the window, and mipmaps generated once would go stale with the first tick
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    if (zoomLevel > 0) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, windowWidth, windowHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        unsigned int first, last;
+        pyramid->takeChangedRows(zoomLevel, first, last);
+        uploadPyramidRows(*pyramid, zoomLevel, 0, windowHeight - 1, levelColors);
+    } else {
+        // rows of the pixel buffer are pixelRowLength() pixels apart
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, simulation->pixelRowLength());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, simulation->pixels());
+    }
 
     std::cout << "Texture initialized..."  << std::endl;
 
@@ -146,11 +366,18 @@ int main()
     // uncomment to activate wireframe mode
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    float *canvasUpdate, *drawUpdate;
-    drawUpdate = new float[(SCR_WIDTH * SCR_HEIGHT) * 4];
-    canvasUpdate = new float[(SCR_WIDTH * SCR_HEIGHT) * 4];
-    int step = 0;
     double xpos, ypos;
+    unsigned int frame = 0;
+    SimulationControl control;
+    // ticks run so far, and the history they left for scrubbing back with the arrow keys
+    unsigned int ticks = 0;
+    std::unique_ptr<RewindBuffer> rewind;
+    if (rewindMegabytes > 0) {
+        rewind.reset(new RewindBuffer(width, height, (size_t)rewindMegabytes * 1024 * 1024));
+    }
+    std::vector<Rgba8> rewindColors((size_t)width * height);
+    // rewindTicks of the frame in the texture
+    unsigned int shownRewindTicks = 0;
 
 	// render loop
 	while (!glfwWindowShouldClose(window))
@@ -158,338 +385,138 @@ int main()
 		// input
 		processInput(window);
         glfwGetCursorPos(window, &xpos, &ypos);
+        // the brush goes where the cursor is in the world, however far it's zoomed out
+        xpos *= (double)width / windowWidth;
+        ypos *= (double)height / windowHeight;
         int leftMouseButtonState = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
         int rightMouseButtonState = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT);
+        int middleMouseButtonState = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE);
         if (leftMouseButtonState == GLFW_PRESS) {
-            drawUpdate = draw(canvasData, xpos, ypos, SAND);
-            canvasUpdate = updateCanvas(drawUpdate, step);
+            inputCommands.push(paintCommand(xpos, ypos, keyInput.brush));
         } else if (rightMouseButtonState == GLFW_PRESS) {
-            drawUpdate = draw(canvasData, xpos, ypos, WATER);
-            canvasUpdate = updateCanvas(drawUpdate, step);
-        } else {
-            canvasUpdate = updateCanvas(canvasData, step);
+            inputCommands.push(paintCommand(xpos, ypos, WATER));
+        } else if (middleMouseButtonState == GLFW_PRESS) {
+            inputCommands.push(eraseCommand(xpos, ypos));
+        }
+        if (keyInput.blast) {
+            inputCommands.push(blastCommand(xpos, ypos));
+            keyInput.blast = false;
         }
 
-        // update texture
-        // canvasUpdate = updateCanvas(drawUpdate, step);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, canvasUpdate);
-        // std::cout << "data:" << canvasData  << std::endl;
-        // std::cout << "update:" << canvasUpdate  << std::endl;
-
-        canvasData = canvasUpdate;
-        step++;
-
-		// render
-		// glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-		// glClear(GL_COLOR_BUFFER_BIT);
-
-        // bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-
-        canvasShader.use();
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-	}
-
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-	// glfw: terminate, clearing all previously allocated GLFWresources.
-	//---------------------------------------------------------------
-	glfwTerminate();
-	return 0;
-}
-
-float *generateCanvas() {
-    std::cout << "Generating canvas..."  << std::endl;
-    float *canvasData;
-    canvasData = new float[(SCR_WIDTH * SCR_HEIGHT) * 4];
-    int value = 0;
-    int i = 0;
-    for(int col = 0; col < SCR_WIDTH; col++) {
-        for(int row = 0; row < SCR_HEIGHT; row++) {
-        
-            // create wall on the bottom
-            if (col <= 20) {
-                canvasData[i] = (float)((117)/255.0);
-                canvasData[i + 1] = (float)((116)/255.0);
-                canvasData[i + 2] = (float)((103)/255.0);
-                canvasData[i + 3] = (float)(1);
+        // tick: everything posted so far goes in first
+        bool canvasChanged = applyCommands(inputCommands, simulation, control);
+        if (control.shouldTick()) {
+            canvasChanged = simulation->update() || canvasChanged;
+            ticks++;
+        }
+        if (canvasChanged) {
+            if (exporter && frame % exportEvery == 0) {
+                exporter->submit(simulation->pixels(), simulation->pixelRowLength(), frame);
             }
-
-            i += 4;
-            value++;
+            if (server) {
+                server->publish(*simulation, frame);
+            }
+            if (rewind) {
+                rewind->record(*simulation, ticks);
+            }
+            frame++;
         }
-    }
-    std::cout << "Finished generating canvas..."  << std::endl;
 
-    return canvasData;
-}
-
-// struct SAND {
-//     float r = (float)((244)/(255.0));
-//     float g = (float)((228)/(255.0));
-//     float b = (float)((101)/(255.0));
-//     float a = (float)(1);
-// }
-
-float *draw(float *currentCanvas, double xpos, double ypos, int particleType) {
-    float *canvasData;
-    canvasData = new float[(SCR_WIDTH * SCR_HEIGHT) * 4];
-    int i = 0;
-
-    // access current pixel
-    double translatedYPos = std::abs(SCR_HEIGHT - ypos);
-    int index = (int)((xpos * 4) + (translatedYPos *  4 * SCR_WIDTH));
-
-    for (int i = 0; i < 10; i++) {
-        drawParticle(&currentCanvas[index + (i * 4)], particleType);
-        for (int j = 0; j < 10; j++) {
-            drawParticle(&currentCanvas[index + (i * 4) - (SCR_WIDTH * 4 * j)], particleType);
+        // scrubbed back: show a recorded frame instead of the live world
+        unsigned int rewindTicks = 0;
+        if (rewind && !rewind->empty()) {
+            rewindTicks = std::min(keyInput.rewindTicks, rewind->lastTick() - rewind->firstTick());
+            keyInput.rewindTicks = rewindTicks;
         }
-    }
-
-    return currentCanvas;
-}
-
-float *updateCanvas(float *currentCanvas, int step) {
-    float *canvasData;
-    canvasData = new float[(SCR_WIDTH * SCR_HEIGHT) * 4];
-    int i = 0;
-
-    for (int col = 0; col < SCR_WIDTH; col++) {
-        for (int row = 0; row < SCR_HEIGHT; row++) {
-
-            // access current pixel
-            float currentRed = *(currentCanvas + (i));
-            float currentGreen = *(currentCanvas + (i) + 1);
-            float currentBlue = *(currentCanvas + (i) + 2);
-            float currentAlpha = *(currentCanvas + (i) + 3);
-            int oldParticleType = getParticleType(currentRed, currentGreen, currentBlue, currentAlpha);
-
-            float canvasRed = *(canvasData + (i));
-            float canvasGreen = *(canvasData + (i) + 1);
-            float canvasBlue = *(canvasData + (i) + 2);
-            float canvasAlpha = *(canvasData + (i) + 3);
-            int updatedParticleType = getParticleType(canvasRed, canvasGreen, canvasBlue, canvasAlpha);
-
-            // need to check if particle from last update moved into this position
-            if (oldParticleType == EMPTY && updatedParticleType != EMPTY) {
-                drawParticle(&canvasData[i], updatedParticleType);
-            } else {
-                if (oldParticleType == WALL) {
-                    drawParticle(&canvasData[i], WALL);
-                } else if (oldParticleType == SAND) {
-                    processSand(i, currentCanvas, canvasData, step);
-                } else if (oldParticleType == WATER) {
-                    processWater(i, currentCanvas, canvasData, step);
-                } else if (oldParticleType == EMPTY) {
-                    drawParticle(&canvasData[i], EMPTY);
+        bool showRewound = rewindTicks > 0 && rewindTicks != shownRewindTicks;
+        bool showLive = rewindTicks == 0 && (canvasChanged || shownRewindTicks > 0);
+
+        // only draw when there is something new to show, otherwise the last frame stays up
+        if (showRewound || showLive || windowNeedsRedraw) {
+            // update texture
+            if (showRewound) {
+                unsigned int shownTick;
+                const unsigned char *materials = rewind->seek(rewind->lastTick() - rewindTicks, &shownTick);
+                if (zoomLevel > 0) {
+                    if (!rewindPyramid) {
+                        rewindPyramid.reset(new MaterialPyramid(width, height));
+                    }
+                    rewindPyramid->rebuild([materials, width](unsigned int x, unsigned int y) {
+                        return materials[(size_t)y * width + x];
+                    });
+                    uploadPyramidRows(*rewindPyramid, zoomLevel, 0, windowHeight - 1, levelColors);
                 } else {
-                    std::cout << "Reached end!!!!!!!!!!!!!!" << std::endl;
+                    colorMaterials(materials, rewindColors.size(), rewindColors.data());
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rewindColors.data());
+                }
+                std::cout << "Showing tick " << shownTick << " of " << rewind->lastTick() << std::endl;
+            } else if (showLive && zoomLevel > 0) {
+                // a world loaded since comes with a pyramid of its own
+                pyramid = simulation->materialPyramid();
+                unsigned int first, last;
+                bool rowsChanged = pyramid->takeChangedRows(zoomLevel, first, last);
+                if (shownRewindTicks > 0) {
+                    first = 0;
+                    last = windowHeight - 1;
+                    rowsChanged = true;
+                }
+                if (rowsChanged) {
+                    uploadPyramidRows(*pyramid, zoomLevel, first, last, levelColors);
                 }
+            } else if (showLive) {
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, simulation->pixelRowLength());
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, simulation->pixels());
             }
+            shownRewindTicks = rewindTicks;
 
-            i += 4;
-        }
-    }
+            // render
+            // glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+            // glClear(GL_COLOR_BUFFER_BIT);
 
-    delete(currentCanvas);
-    return canvasData;
-}
+            // bind texture
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, texture1);
 
-void processSand(int i, float *currentCanvas, float* canvasData, int step) {
-    // check what's below
-    float downRed = *(canvasData + (i) - (4 * SCR_WIDTH));
-    float downGreen = *(canvasData + (i) - (4 * SCR_WIDTH) + 1);
-    float downBlue = *(canvasData + (i) - (4 * SCR_WIDTH) + 2);
-    float downAlpha = *(canvasData + (i) - (4 * SCR_WIDTH) + 3);
-    int downType = getParticleType(downRed, downGreen, downBlue, downAlpha);
-
-    // move sand down one pixel if empty space underneath
-    if (downType == EMPTY) {
-        // fall down
-        drawParticle(&canvasData[i], EMPTY);
-        drawParticle(&canvasData[(i - (4 * SCR_WIDTH))], SAND);
-
-    // check for sand below
-    } else if (downType == SAND) {
-        // check for space to the left
-        float downLeftRed = *(canvasData + (i - (4 * SCR_WIDTH) - 4));
-        float downLeftGreen = *(canvasData + (i - (4 * SCR_WIDTH) - 3));
-        float downLeftBlue = *(canvasData + (i - (4 * SCR_WIDTH) - 2));
-        float downLeftAlpha = *(canvasData + (i - (4 * SCR_WIDTH) - 1));
-        int downLeftType = getParticleType(downLeftRed, downLeftGreen, downLeftBlue, downLeftAlpha);
-        
-        // check for space to the right
-        float downRightRed = *(canvasData + (i - (4 * SCR_WIDTH) + 4));
-        float downRightGreen = *(canvasData + (i - (4 * SCR_WIDTH) + 5));
-        float downRightBlue = *(canvasData + (i - (4 * SCR_WIDTH) + 6));
-        float downRightAlpha = *(canvasData + (i - (4 * SCR_WIDTH) + 7));
-        int downRightType = getParticleType(downRightRed, downRightGreen, downRightBlue, downRightAlpha);
-
-        if (downRightType == EMPTY) {
-            // fall right
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) + 4], SAND);
-
-        } else if (downLeftType == EMPTY) {
-            // fall left
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) - 4], SAND);
-        } else if (downLeftType == WATER) {
-            // fall left
-            drawParticle(&canvasData[i], WATER);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) - 4], SAND);
-
-        } else if (downRightType == WATER) {
-            // fall right
-            drawParticle(&canvasData[i], WATER);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) + 4], SAND);
-        } else {
-            // draw sand in same spot (piling up)
-            drawParticle(&canvasData[i], SAND);
+            canvasShader.use();
+            glBindVertexArray(VAO);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+            // glfw: swap buffers
+            glfwSwapBuffers(window);
+            windowNeedsRedraw = false;
         }
-    } else if (downType == WATER) {
-        // sink
-        drawParticle(&canvasData[i], WATER);
-        drawParticle(&canvasData[(i - (4 * SCR_WIDTH))], SAND);
-    } else if (downType == WALL) {
-        // draw sand
-        drawParticle(&canvasData[i], SAND);
-    }
-}
 
-void processWater(int i, float *currentCanvas, float* canvasData, int step) {
-    // check what's below
-    float downRed = *(canvasData + (i) - (4 * SCR_WIDTH));
-    float downGreen = *(canvasData + (i) - (4 * SCR_WIDTH) + 1);
-    float downBlue = *(canvasData + (i) - (4 * SCR_WIDTH) + 2);
-    float downAlpha = *(canvasData + (i) - (4 * SCR_WIDTH) + 3);
-    int downType = getParticleType(downRed, downGreen, downBlue, downAlpha);
-
-    // move sand down one pixel if empty space underneath
-    if (downType == EMPTY) {
-        // fall down
-        drawParticle(&canvasData[i], EMPTY);
-        drawParticle(&canvasData[(i - (4 * SCR_WIDTH))], WATER);
-
-    } else if (downType == SAND || downType == WALL || downType == WATER) {
-        // check for space to the left
-        float leftRed = *(canvasData + (i - 4));
-        float leftGreen = *(canvasData + (i - 3));
-        float leftBlue = *(canvasData + (i - 2));
-        float leftAlpha = *(canvasData + (i - 1));
-        int leftType = getParticleType(leftRed, leftGreen, leftBlue, leftAlpha);
-
-        // check for space to the right
-        float rightRed = *(currentCanvas + (i + 4));
-        float rightGreen = *(currentCanvas + (i + 5));
-        float rightBlue = *(currentCanvas + (i + 6));
-        float rightAlpha = *(currentCanvas + (i + 7));
-        int rightType = getParticleType(rightRed, rightGreen, rightBlue, rightAlpha);
-
-        // check for space to the downward left
-        float downLeftRed = *(canvasData + (i - (4 * SCR_WIDTH) - 4));
-        float downLeftGreen = *(canvasData + (i - (4 * SCR_WIDTH) - 3));
-        float downLeftBlue = *(canvasData + (i - (4 * SCR_WIDTH) - 2));
-        float downLeftAlpha = *(canvasData + (i - (4 * SCR_WIDTH) - 1));
-        int downLeftType = getParticleType(downLeftRed, downLeftGreen, downLeftBlue, downLeftAlpha);
-        
-        // check for space to the downward right
-        float downRightRed = *(canvasData + (i - (4 * SCR_WIDTH) + 4));
-        float downRightGreen = *(canvasData + (i - (4 * SCR_WIDTH) + 5));
-        float downRightBlue = *(canvasData + (i - (4 * SCR_WIDTH) + 6));
-        float downRightAlpha = *(canvasData + (i - (4 * SCR_WIDTH) + 7));
-        int downRightType = getParticleType(downRightRed, downRightGreen, downRightBlue, downRightAlpha);
-
-        if (downRightType == EMPTY) {
-            // fall right
-            // std::cout << "fall left" << std::endl;
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) + 4], WATER);
-        } else if (downLeftType == EMPTY) {
-            // fall right
-            // std::cout << "fall left" << std::endl;
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[(i - (4 * SCR_WIDTH)) - 4], WATER);
-        } else if (rightType == EMPTY) {
-            // std::cout << "move right" << std::endl;
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[i + 4], WATER);
-        } else if (leftType == EMPTY) {
-            // std::cout << "move left" << std::endl;
-            drawParticle(&canvasData[i], EMPTY);
-            drawParticle(&canvasData[i - 4], WATER);
+        // glfw: poll IO events (keys pressed/released, mouse moved etc.). once the world
+        // has settled there's nothing to do until the user does something, so sleep
+        // until an event arrives instead of spinning
+        if (simulation->settled() || (control.paused && control.steps == 0)) {
+            glfwWaitEvents();
         } else {
-            // draw water in same spot (piling up)
-            // std::cout << "stay still" << std::endl;
-            drawParticle(&canvasData[i], WATER);
+            glfwPollEvents();
         }
-    } /*else if (downType == WATER) {
-        drawParticle(&canvasData[i], WATER);
-    }*/
-}
+	}
 
-int getParticleType(float r, float g, float b, float a) {
-    if (r == (float)((0)/255.0) &&
-        g == (float)((0)/255.0) &&
-        b == (float)((0)/255.0) &&
-        a == (float)(1))
-    {
-        return EMPTY;
-    } else if (r == (float)((117)/255.0) &&
-               g == (float)((116)/255.0) &&
-               b == (float)((103)/255.0) &&
-               a == (float)(1))
-    {
-        return WALL;
-    } else if (r == (float)((244)/255.0) &&
-               g == (float)((228)/255.0) &&
-               b == (float)((101)/255.0) &&
-               a == (float)(1))
-    {
-        return SAND;
-    } else if (r == (float)((17)/255.0) &&
-               g == (float)((65)/255.0) &&
-               b == (float)((166)/255.0) &&
-               a == (float)(1))
-    {
-        return WATER;
-    } else {
-        return EMPTY;
+    if (exporter) {
+        exporter->finish();
     }
-}
-
-void drawParticle(float *canvasLocation, int particleType)
-{
-    if (particleType == EMPTY) {
-        *canvasLocation = (float)((0)/255.0);
-        *(canvasLocation + 1) = (float)((0)/255.0);
-        *(canvasLocation + 2) = (float)((0)/255.0);
-        *(canvasLocation + 3) = (float)(1);
-    } else if (particleType == WALL) {
-        *canvasLocation = ((117)/255.0);
-        *(canvasLocation + 1) = (float)((116)/255.0);
-        *(canvasLocation + 2) = (float)((103)/255.0);
-        *(canvasLocation + 3) = (float)(1);
-    } else if (particleType == SAND) {
-        *canvasLocation = (float)((244)/(255.0));
-        *(canvasLocation + 1) = (float)((228)/(255.0));
-        *(canvasLocation + 2) = (float)((101)/(255.0));
-        *(canvasLocation + 3) = (float)(1);
-    } else if (particleType == WATER) {
-        *canvasLocation = (float)((17)/(255.0));
-        *(canvasLocation + 1) = (float)((65)/(255.0));
-        *(canvasLocation + 2) = (float)((166)/(255.0));
-        *(canvasLocation + 3) = (float)(1);
+    if (server) {
+        std::cout << server->report() << std::endl;
+    }
+    if (rewind) {
+        std::cout << rewind->report() << std::endl;
+    }
+    if (inputCommands.droppedCount() > 0) {
+        std::cout << inputCommands.droppedCount() << " input commands dropped, the queue was full" << std::endl;
     }
 
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+	// glfw: terminate, clearing all previously allocated GLFWresources.
+	//---------------------------------------------------------------
+	glfwTerminate();
+	return 0;
 }
 
 void processInput(GLFWwindow *window)
@@ -499,6 +526,45 @@ void processInput(GLFWwindow *window)
 		glfwSetWindowShouldClose(window, true);
 }
 
+// glfw: key presses that aren't held down. space pauses and resumes, n steps a paused
+// world by one tick, r loads a fresh world unless the world is streamed from a server.
+// the number keys pick what the left button paints, in materialDefinitions order from
+// 1 for wall, and b blasts what's under the cursor into the air.
+// left and right scrub a paused world back and forward through its recent history, a
+// tick at a time or a second's worth with shift held; resuming shows the live world
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    // ticks the arrow keys scrub by with shift held
+    const unsigned int SCRUB_TICKS_FAST = 60;
+
+    bool scrubbing = key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT;
+    if (action != GLFW_PRESS && !(action == GLFW_REPEAT && scrubbing)) {
+        return;
+    }
+    unsigned int scrubTicks = (mods & GLFW_MOD_SHIFT) ? SCRUB_TICKS_FAST : 1;
+    if (key == GLFW_KEY_SPACE) {
+        keyInput.paused = !keyInput.paused;
+        keyInput.rewindTicks = 0;
+        inputCommands.push(pauseCommand(keyInput.paused));
+    } else if (key == GLFW_KEY_LEFT) {
+        if (!keyInput.paused) {
+            keyInput.paused = true;
+            inputCommands.push(pauseCommand(true));
+        }
+        keyInput.rewindTicks += scrubTicks;
+    } else if (key == GLFW_KEY_RIGHT) {
+        keyInput.rewindTicks -= std::min(keyInput.rewindTicks, scrubTicks);
+    } else if (key == GLFW_KEY_N) {
+        inputCommands.push(stepCommand());
+    } else if (key == GLFW_KEY_R && !keyInput.streamed) {
+        inputCommands.postLoad(makeSimulation(keyInput.width, keyInput.height, keyInput.engine));
+    } else if (key == GLFW_KEY_B && !keyInput.streamed) {
+        keyInput.blast = true;
+    } else if (key >= GLFW_KEY_1 && key < GLFW_KEY_0 + MATERIAL_COUNT && key <= GLFW_KEY_9) {
+        keyInput.brush = key - GLFW_KEY_0;
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
@@ -506,6 +572,13 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 	// make sure the viewport matches the new window dimensions; note that width and
 	// height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
+	windowNeedsRedraw = true;
+}
+
+// glfw: the window contents were damaged (uncovered, restored, ...) and have to be drawn again
+void window_refresh_callback(GLFWwindow *window)
+{
+    windowNeedsRedraw = true;
 }
 
 void initializeCanvas()
@@ -519,4 +592,50 @@ void initializeCanvas()
     };
 
 
-}
\ No newline at end of file
+}
+
+// color rows first..last of a pyramid level into the bound texture, which has the
+// level's size
+void uploadPyramidRows(const MaterialPyramid &pyramid, unsigned int level, unsigned int first, unsigned int last,
+                       std::vector<Rgba8> &colors)
+{
+    unsigned int levelWidth = pyramid.levelWidth(level);
+    size_t offset = (size_t)first * levelWidth;
+    colorMaterials(pyramid.level(level) + offset, (size_t)(last - first + 1) * levelWidth, colors.data() + offset);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, levelWidth);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, levelWidth, last - first + 1, GL_RGBA, GL_UNSIGNED_BYTE, colors.data() + offset);
+}
+
+// run the simulation without a window or GL context, e.g. for exporting frames on a
+// machine without a display
+int runHeadless(Simulation &simulation, unsigned int ticks, FrameExporter *exporter, unsigned int exportEvery,
+                FrameStreamServer *server)
+{
+    std::cout << "Running " << ticks << " ticks headless..." << std::endl;
+    for (unsigned int tick = 0; tick < ticks; tick++) {
+        pourInput(simulation, tick);
+        simulation.update();
+
+        if (exporter != NULL && tick % exportEvery == 0) {
+            exporter->submit(simulation.pixels(), simulation.pixelRowLength(), tick);
+        }
+        if (server != NULL) {
+            server->publish(simulation, tick);
+        }
+    }
+
+    std::string threadReport = simulation.threadReport();
+    if (!threadReport.empty()) {
+        std::cout << threadReport << std::endl;
+    }
+    if (exporter != NULL) {
+        exporter->finish();
+    }
+    if (server != NULL) {
+        // let the viewers have the last frames before the socket goes away
+        const int STREAM_DRAIN_MS = 1000;
+        server->finish(STREAM_DRAIN_MS);
+        std::cout << server->report() << std::endl;
+    }
+    return 0;
+}